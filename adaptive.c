@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "adaptive.h"
+#include "parallel.h"
+#include "colour.h"
+
+/* Rows read per band; each band also keeps the last row of the previous one */
+#define BAND_ROWS 64
+
+/* Data shared by the workers of one band */
+typedef struct _ComplexityJob
+{
+    ChannelMap *map;
+    const unsigned char *band; // Row above the band, then the band rows
+    uint band_start;           // Image row of the first band row
+    unsigned long long (*hist)[256]; // One histogram per thread
+    unsigned short *grad;            // One row of gradients per thread
+} ComplexityJob;
+
+/* Function Definitions */
+
+/* Complexity of a slice of band rows
+ * Description: For every byte, |right - here| + |here - above| on the
+ * values without their LSB; the colour bytes of a pixel are summed and
+ * clamped to 255. The first loop is a plain byte loop so the compiler
+ * can vectorise it.
+ */
+static void complexity_rows(void *ctx, uint row_begin, uint row_end, int thread_id)
+{
+    ComplexityJob *job = ctx;
+    ChannelMap *map = job->map;
+    uint bpp = map->bytes_per_pixel;
+    uint row_bytes = map->width * bpp;
+    unsigned short *grad = job->grad + (size_t)thread_id * row_bytes;
+
+    for (uint r = row_begin; r < row_end; r++)
+    {
+        uint image_row = job->band_start + r;
+        const unsigned char *here = job->band + (size_t)(r + 1) * map->row_stride;
+        const unsigned char *above = image_row > 0 ? here - map->row_stride : here;
+
+        for (uint i = 0; i + bpp < row_bytes; i++)
+        {
+            int h = here[i] >> 1;
+            grad[i] = abs((here[i + bpp] >> 1) - h) + abs(h - (above[i] >> 1));
+        }
+        // Last pixel has no right neighbour, use the left one
+        for (uint i = row_bytes - bpp; i < row_bytes; i++)
+        {
+            int h = here[i] >> 1;
+            grad[i] = abs(h - (here[i - (row_bytes > bpp ? bpp : 0)] >> 1)) + abs(h - (above[i] >> 1));
+        }
+
+        unsigned char *complexity = map->complexity + (size_t)image_row * map->width;
+        for (uint x = 0; x < map->width; x++)
+        {
+            // Colour channels only, alpha does not count
+            uint sum = grad[x * bpp] + grad[x * bpp + 1] + grad[x * bpp + 2];
+            complexity[x] = sum > 255 ? 255 : sum;
+            if (image_row >= map->first_row)
+                job->hist[thread_id][complexity[x]]++;
+        }
+    }
+}
+
+/* Build the complexity map from the pixel array at the current position
+ * Description: Bands are read forward-only and split across the threads
+ * of one pool kept for the whole image; each thread keeps its own
+ * gradient row and histogram.
+ */
+Status build_complexity_map(ChannelMap *map, FILE *fptr_image)
+{
+    RowPool pool;
+    if (open_row_pool(&pool) == failure)
+        return failure;
+
+    uint height = map->first_row + map->rows;
+    int nthreads = pool.nthreads;
+    uint band_rows = height < BAND_ROWS ? height : BAND_ROWS;
+    unsigned char *band = malloc((size_t)map->row_stride * (band_rows + 1));
+    unsigned long long (*hist)[256] = calloc(nthreads, sizeof(*hist));
+    unsigned short *grad = malloc((size_t)nthreads * map->width * map->bytes_per_pixel * sizeof(unsigned short));
+    map->complexity = malloc((size_t)map->width * height);
+    Status status = success;
+
+    if (band == NULL || hist == NULL || grad == NULL || map->complexity == NULL)
+    {
+        fprintf(stderr, RED"ERROR: Unable to allocate complexity map\n"RESET);
+        free(band);
+        free(hist);
+        free(grad);
+        close_row_pool(&pool);
+        return failure;
+    }
+
+    ComplexityJob job = { map, band, 0, hist, grad };
+    while (job.band_start < height)
+    {
+        uint rows = height - job.band_start < BAND_ROWS ? height - job.band_start : BAND_ROWS;
+
+        // Row above the band is the last row of the previous band
+        if (job.band_start > 0)
+            memmove(band, band + (size_t)BAND_ROWS * map->row_stride, map->row_stride);
+
+        if (fread(band + map->row_stride, map->row_stride, rows, fptr_image) != rows)
+        {
+            fprintf(stderr, RED"ERROR: Pixel array is truncated\n"RESET);
+            status = failure;
+            break;
+        }
+
+        if (run_pool_rows(&pool, rows, complexity_rows, &job) == failure)
+        {
+            status = failure;
+            break;
+        }
+        job.band_start += rows;
+    }
+
+    memset(map->complexity_hist, 0, sizeof(map->complexity_hist));
+    for (int t = 0; t < nthreads; t++)
+        for (int v = 0; v < 256; v++)
+            map->complexity_hist[v] += hist[t][v];
+
+    free(band);
+    free(hist);
+    free(grad);
+    close_row_pool(&pool);
+    return status;
+}
+
+/* Pick the highest threshold whose capacity holds needed bytes */
+uint choose_adaptive_threshold(ChannelMap *map, unsigned long long needed)
+{
+    unsigned long long pixels = 0;
+    for (uint t = 255; t >= 1; t--)
+    {
+        pixels += map->complexity_hist[t];
+        if (pixels * map->per_pixel / 8 >= needed)
+        {
+            map->threshold = t;
+            return t;
+        }
+    }
+    map->threshold = 0;
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <stdio.h>
+#include "types.h"   // Contains user defined types
+#include "channel.h" // Contains ChannelMap
+
+/*
+ * Edge-adaptive embedding: every pixel gets a complexity from the
+ * gradients of its higher bit planes (value >> 1), which embedding never
+ * changes, so the decoder rebuilds the same map from the stego image.
+ * Only pixels at or above a threshold are used; the encoder picks the
+ * highest threshold that still fits the payload.
+ */
+
+/* Build the complexity map from the pixel array at the current position */
+Status build_complexity_map(ChannelMap *map, FILE *fptr_image);
+
+/* Pick the highest threshold (1..255) whose capacity holds needed bytes, 0 if none */
+uint choose_adaptive_threshold(ChannelMap *map, unsigned long long needed);
+
+#endif
@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "analyze.h"
+#include "encode.h"
+#include "parallel.h"
+#include "stream.h"
+#include "colour.h"
+
+/* Rows read and scanned per band */
+#define BAND_ROWS 256
+
+/* Pairs of values with fewer samples than this are left out of the chi-square */
+#define CHI_MIN_PAIR 5
+
+/* RS groups counted in 16 bit SIMD lanes before they are added up (4096 per lane) */
+#define RS_BLOCK_GROUPS (8 * 4096)
+
+/* Per thread accumulators, merged after every band */
+typedef struct _ScanStats
+{
+    unsigned long long hist[ANALYZE_CHANNELS][256];
+    unsigned long long rs_counts[ANALYZE_CHANNELS][RS_COUNTERS];
+} ScanStats;
+
+/* Data shared by the workers of one band */
+typedef struct _ScanJob
+{
+    AnalyzeInfo *anInfo;
+    const unsigned char *band; // Rows of the current band
+    ScanStats *stats;          // One per thread
+    unsigned char *planes;     // Per thread scratch, see split_row()
+    uint groups;               // RS groups of 4 pixels per row
+} ScanJob;
+
+/* Function Definitions */
+
+/* Read and validate analyze arguments */
+Status read_and_validate_analyze_args(char *argv[], AnalyzeInfo *anInfo)
+{
+    if (argv[2] == NULL)
+    {
+        printf(RED"ERROR: Image not provided\n"RESET);
+        return failure;
+    }
+
+    char *dot = strrchr(argv[2], '.');
+    if (!is_stream_fname(argv[2]) && (dot == NULL || strcmp(dot, ".bmp") != 0))
+    {
+        printf(RED"ERROR: Image file must be .bmp\n"RESET);
+        return failure;
+    }
+
+    anInfo->image_fname = argv[2];
+    return success;
+}
+
+/* Smoothness of a group of 4 pixels: sum of neighbour differences */
+static int group_smoothness(int a, int b, int c, int d)
+{
+    return abs(b - a) + abs(c - b) + abs(d - c);
+}
+
+/* Flip an LSB: 0 <-> 1, 2 <-> 3, ... */
+static int flip_positive(int x)
+{
+    return x ^ 1;
+}
+
+/* Shifted flip: -1 <-> 0, 1 <-> 2, ... */
+static int flip_negative(int x)
+{
+    return ((x + 1) ^ 1) - 1;
+}
+
+/* Classify one group as Regular/Singular for the mask [0 1 1 0] and its negative */
+static void rs_classify(int a, int b, int c, int d, unsigned long long *counts)
+{
+    int f = group_smoothness(a, b, c, d);
+    int f_pos = group_smoothness(a, flip_positive(b), flip_positive(c), d);
+    int f_neg = group_smoothness(a, flip_negative(b), flip_negative(c), d);
+
+    counts[0] += f_pos > f;
+    counts[1] += f_pos < f;
+    counts[2] += f_neg > f;
+    counts[3] += f_neg < f;
+}
+
+/* Saturated values (0, 255) can't move both ways, so groups holding one
+ * are left out of RS: they otherwise skew the estimate of clean covers
+ * with clipped areas */
+static int rs_saturated(int a, int b, int c, int d)
+{
+    return a == 0 || a == 255 || b == 0 || b == 255 ||
+           c == 0 || c == 255 || d == 0 || d == 255;
+}
+
+/* RS counts of groups [g, groups) of one channel, one value per plane */
+static void rs_count_scalar(const unsigned char *plane, uint groups, uint g, unsigned long long *counts)
+{
+    for (; g < groups; g++)
+    {
+        int a = plane[g], b = plane[groups + g], c = plane[2 * groups + g], d = plane[3 * groups + g];
+        if (rs_saturated(a, b, c, d))
+            continue;
+        rs_classify(a, b, c, d, counts);
+        rs_classify(a ^ 1, b ^ 1, c ^ 1, d ^ 1, counts + 4);
+    }
+}
+
+#ifdef __SSE2__
+
+/* |x - y| of 8 16 bit values */
+static inline __m128i absdiff8(__m128i x, __m128i y)
+{
+    return _mm_max_epi16(_mm_sub_epi16(x, y), _mm_sub_epi16(y, x));
+}
+
+/* group_smoothness() of 8 groups */
+static inline __m128i smoothness8(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+    return _mm_add_epi16(_mm_add_epi16(absdiff8(b, a), absdiff8(c, b)), absdiff8(d, c));
+}
+
+/* flip_negative() of 8 values: x - 1 + 2 * (x & 1) */
+static inline __m128i flip_negative8(__m128i x, __m128i one)
+{
+    __m128i odd = _mm_and_si128(x, one);
+    return _mm_sub_epi16(_mm_add_epi16(x, _mm_add_epi16(odd, odd)), one);
+}
+
+/* Load 8 plane bytes as 16 bit values */
+static inline __m128i load8(const unsigned char *p)
+{
+    return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)p), _mm_setzero_si128());
+}
+
+/* RS counts 8 groups at a time, the same as rs_count_scalar()
+ * Description: Each comparison gives 0 or -1 per lane, which is
+ * subtracted from a 16 bit counter; the counters are added up every
+ * RS_BLOCK_GROUPS groups, before they can wrap.
+ * Returns the first group left for the scalar loop.
+ */
+static uint rs_count_simd(const unsigned char *plane, uint groups, unsigned long long *counts)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i top = _mm_set1_epi16(255);
+    uint g = 0;
+
+    while (g + 8 <= groups)
+    {
+        __m128i acc[RS_COUNTERS];
+        for (int k = 0; k < RS_COUNTERS; k++)
+            acc[k] = zero;
+
+        uint block_end = groups - g > RS_BLOCK_GROUPS ? g + RS_BLOCK_GROUPS : groups;
+        for (; g + 8 <= block_end; g += 8)
+        {
+            __m128i a = load8(plane + g);
+            __m128i b = load8(plane + groups + g);
+            __m128i c = load8(plane + 2 * groups + g);
+            __m128i d = load8(plane + 3 * groups + g);
+
+            __m128i sat = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(a, zero), _mm_cmpeq_epi16(a, top)),
+                                       _mm_or_si128(_mm_cmpeq_epi16(b, zero), _mm_cmpeq_epi16(b, top)));
+            sat = _mm_or_si128(sat, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(c, zero), _mm_cmpeq_epi16(c, top)),
+                                                 _mm_or_si128(_mm_cmpeq_epi16(d, zero), _mm_cmpeq_epi16(d, top))));
+
+            // Image as it is
+            __m128i f = smoothness8(a, b, c, d);
+            __m128i f_pos = smoothness8(a, _mm_xor_si128(b, one), _mm_xor_si128(c, one), d);
+            __m128i f_neg = smoothness8(a, flip_negative8(b, one), flip_negative8(c, one), d);
+            acc[0] = _mm_sub_epi16(acc[0], _mm_andnot_si128(sat, _mm_cmpgt_epi16(f_pos, f)));
+            acc[1] = _mm_sub_epi16(acc[1], _mm_andnot_si128(sat, _mm_cmpgt_epi16(f, f_pos)));
+            acc[2] = _mm_sub_epi16(acc[2], _mm_andnot_si128(sat, _mm_cmpgt_epi16(f_neg, f)));
+            acc[3] = _mm_sub_epi16(acc[3], _mm_andnot_si128(sat, _mm_cmpgt_epi16(f, f_neg)));
+
+            // Same groups with every LSB flipped (flipping b and c back gives b and c)
+            __m128i a1 = _mm_xor_si128(a, one), b1 = _mm_xor_si128(b, one);
+            __m128i c1 = _mm_xor_si128(c, one), d1 = _mm_xor_si128(d, one);
+            f = smoothness8(a1, b1, c1, d1);
+            f_pos = smoothness8(a1, b, c, d1);
+            f_neg = smoothness8(a1, flip_negative8(b1, one), flip_negative8(c1, one), d1);
+            acc[4] = _mm_sub_epi16(acc[4], _mm_andnot_si128(sat, _mm_cmpgt_epi16(f_pos, f)));
+            acc[5] = _mm_sub_epi16(acc[5], _mm_andnot_si128(sat, _mm_cmpgt_epi16(f, f_pos)));
+            acc[6] = _mm_sub_epi16(acc[6], _mm_andnot_si128(sat, _mm_cmpgt_epi16(f_neg, f)));
+            acc[7] = _mm_sub_epi16(acc[7], _mm_andnot_si128(sat, _mm_cmpgt_epi16(f, f_neg)));
+        }
+
+        for (int k = 0; k < RS_COUNTERS; k++)
+        {
+            unsigned short lanes[8];
+            _mm_storeu_si128((__m128i *)lanes, acc[k]);
+            for (int i = 0; i < 8; i++)
+                counts[k] += lanes[i];
+        }
+    }
+    return g;
+}
+
+#endif
+
+/* Split a row into unit-stride planes while building the histogram
+ * Description: planes holds 4 planes per channel, plane k of channel c
+ * at (c * 4 + k) * groups, with the k-th value of every group, so the
+ * RS kernel reads each operand with plain consecutive loads.
+ */
+static void split_row(const unsigned char *pixels, uint width, uint bpp, uint groups,
+                      unsigned char *planes, ScanStats *stats)
+{
+    unsigned char *plane_b = planes, *plane_g = planes + 4 * groups, *plane_r = planes + 8 * groups;
+    const unsigned char *p = pixels;
+
+    for (uint g = 0; g < groups; g++)
+    {
+        for (uint k = 0; k < 4; k++, p += bpp)
+        {
+            stats->hist[0][p[0]]++;
+            stats->hist[1][p[1]]++;
+            stats->hist[2][p[2]]++;
+            plane_b[k * groups + g] = p[0];
+            plane_g[k * groups + g] = p[1];
+            plane_r[k * groups + g] = p[2];
+        }
+    }
+
+    // Pixels after the last whole group only count in the histogram
+    for (uint x = groups * 4; x < width; x++, p += bpp)
+    {
+        stats->hist[0][p[0]]++;
+        stats->hist[1][p[1]]++;
+        stats->hist[2][p[2]]++;
+    }
+}
+
+/* Scan a slice of rows of the current band */
+static void scan_rows(void *ctx, uint row_begin, uint row_end, int thread_id)
+{
+    ScanJob *job = ctx;
+    AnalyzeInfo *anInfo = job->anInfo;
+    ScanStats *stats = &job->stats[thread_id];
+    uint groups = job->groups;
+    unsigned char *planes = job->planes + (size_t)thread_id * ANALYZE_CHANNELS * 4 * groups;
+
+    for (uint row = row_begin; row < row_end; row++)
+    {
+        const unsigned char *pixels = job->band + (size_t)row * anInfo->row_stride;
+        split_row(pixels, anInfo->width, anInfo->bytes_per_pixel, groups, planes, stats);
+
+        // RS groups of 4 horizontally adjacent pixels
+        for (int c = 0; c < ANALYZE_CHANNELS; c++)
+        {
+            const unsigned char *plane = planes + (size_t)c * 4 * groups;
+            uint g = 0;
+#ifdef __SSE2__
+            g = rs_count_simd(plane, groups, stats->rs_counts[c]);
+#endif
+            rs_count_scalar(plane, groups, g, stats->rs_counts[c]);
+        }
+    }
+}
+
+/* Stream the pixel array band by band
+ * Description: Each band of rows is read forward-only, split across the
+ * threads of one pool kept for the whole image, and the per thread
+ * counters are merged afterwards.
+ */
+Status scan_pixel_array(AnalyzeInfo *anInfo)
+{
+    RowPool pool;
+    if (open_row_pool(&pool) == failure)
+        return failure;
+
+    int nthreads = pool.nthreads;
+    uint groups = anInfo->width / 4;
+    size_t band_size = (size_t)anInfo->row_stride * BAND_ROWS;
+    unsigned char *band = malloc(band_size);
+    ScanStats *stats = calloc(nthreads, sizeof(ScanStats));
+    unsigned char *planes = malloc((size_t)nthreads * ANALYZE_CHANNELS * 4 * groups + 1);
+    Status status = success;
+
+    if (band == NULL || stats == NULL || planes == NULL)
+    {
+        fprintf(stderr, RED"ERROR: Unable to allocate scan buffers\n"RESET);
+        free(band);
+        free(stats);
+        free(planes);
+        close_row_pool(&pool);
+        return failure;
+    }
+
+    ScanJob job = { anInfo, band, stats, planes, groups };
+    uint rows_left = anInfo->height;
+
+    while (rows_left > 0)
+    {
+        uint rows = rows_left < BAND_ROWS ? rows_left : BAND_ROWS;
+        if (fread(band, anInfo->row_stride, rows, anInfo->fptr_image) != rows)
+        {
+            fprintf(stderr, RED"ERROR: Pixel array is truncated\n"RESET);
+            status = failure;
+            break;
+        }
+
+        if (run_pool_rows(&pool, rows, scan_rows, &job) == failure)
+        {
+            status = failure;
+            break;
+        }
+        rows_left -= rows;
+    }
+
+    // Merge the per thread counters
+    for (int t = 0; t < nthreads; t++)
+    {
+        for (int c = 0; c < ANALYZE_CHANNELS; c++)
+        {
+            for (int v = 0; v < 256; v++)
+                anInfo->hist[c][v] += stats[t].hist[c][v];
+            for (int k = 0; k < RS_COUNTERS; k++)
+                anInfo->rs_counts[c][k] += stats[t].rs_counts[c][k];
+        }
+    }
+
+    // LSB histogram comes straight from the odd values
+    for (int c = 0; c < ANALYZE_CHANNELS; c++)
+    {
+        for (int v = 0; v < 256; v++)
+        {
+            anInfo->samples[c] += anInfo->hist[c][v];
+            if (v & 1)
+                anInfo->lsb_ones[c] += anInfo->hist[c][v];
+        }
+    }
+
+    close_row_pool(&pool);
+    free(band);
+    free(stats);
+    free(planes);
+    return status;
+}
+
+/* Chi-square attack
+ * Description: LSB replacement makes the counts of 2k and 2k+1 equal.
+ * The chi-square of each pair against its mean is turned into the
+ * probability of embedding with the Wilson-Hilferty approximation of
+ * the chi-square distribution.
+ */
+Status compute_chi_square(AnalyzeInfo *anInfo)
+{
+    for (int c = 0; c < ANALYZE_CHANNELS; c++)
+    {
+        double chi = 0;
+        int pairs = 0;
+
+        for (int k = 0; k < 128; k++)
+        {
+            double even = anInfo->hist[c][2 * k];
+            double odd = anInfo->hist[c][2 * k + 1];
+            if (even + odd < CHI_MIN_PAIR)
+                continue;
+
+            double expected = (even + odd) / 2;
+            chi += (even - expected) * (even - expected) / expected;
+            pairs++;
+        }
+
+        anInfo->chi_square[c] = chi;
+        if (pairs < 2)
+        {
+            anInfo->chi_p[c] = 0;
+            continue;
+        }
+
+        double dof = pairs - 1;
+        double z = (cbrt(chi / dof) - (1 - 2 / (9 * dof))) / sqrt(2 / (9 * dof));
+        anInfo->chi_p[c] = 0.5 * erfc(z / sqrt(2));
+    }
+    return success;
+}
+
+/* RS analysis
+ * Description: Solves the RS quadratic
+ * 2(d1 + d0)x^2 + (d-0 - d-1 - d1 - 3d0)x + d0 - d-0 = 0
+ * and takes the smaller root; the embedded fraction is x / (x - 1/2).
+ */
+Status compute_rs_estimate(AnalyzeInfo *anInfo)
+{
+    for (int c = 0; c < ANALYZE_CHANNELS; c++)
+    {
+        unsigned long long *n = anInfo->rs_counts[c];
+        double d0 = (double)n[0] - (double)n[1];
+        double dn0 = (double)n[2] - (double)n[3];
+        double d1 = (double)n[4] - (double)n[5];
+        double dn1 = (double)n[6] - (double)n[7];
+
+        double a = 2 * (d1 + d0);
+        double b = dn0 - dn1 - d1 - 3 * d0;
+        double k = d0 - dn0;
+        double x;
+
+        if (fabs(a) < 1e-9)
+            x = fabs(b) < 1e-9 ? 0 : -k / b;
+        else
+        {
+            double disc = b * b - 4 * a * k;
+            if (disc < 0)
+                disc = 0;
+            double x1 = (-b + sqrt(disc)) / (2 * a);
+            double x2 = (-b - sqrt(disc)) / (2 * a);
+            x = fabs(x1) < fabs(x2) ? x1 : x2;
+        }
+
+        double p = fabs(x - 0.5) < 1e-9 ? 1 : x / (x - 0.5);
+        if (p < 0)
+            p = 0;
+        if (p > 1)
+            p = 1;
+        anInfo->rs_estimate[c] = p;
+    }
+    return success;
+}
+
+/* Print the report */
+void print_analysis_report(AnalyzeInfo *anInfo)
+{
+    const char *names[ANALYZE_CHANNELS] = { "Blue", "Green", "Red" };
+
+    for (int c = 0; c < ANALYZE_CHANNELS; c++)
+    {
+        double ones = anInfo->samples[c] ? (double)anInfo->lsb_ones[c] / anInfo->samples[c] : 0;
+        printf(MAGENTA"     %-5s"RESET" LSB ones = "BOLD"%.4f"RESET
+               "  chi-square = "BOLD"%.1f"RESET" (p = "BOLD"%.3f"RESET")"
+               "  RS estimate = "BOLD"%.3f\n"RESET,
+               names[c], ones, anInfo->chi_square[c], anInfo->chi_p[c], anInfo->rs_estimate[c]);
+    }
+
+    printf(MAGENTA"     Suitability score = "RESET BOLD"%.1f / 100\n"RESET, anInfo->score);
+    if (anInfo->score >= 90)
+        printf(GREEN"SUCCESS: LSB plane looks natural, good cover / unlikely to be flagged\n"RESET);
+    else if (anInfo->score >= 60)
+        printf(YELLOW"WARNING: LSB plane is partly randomised, may be flagged\n"RESET);
+    else
+        printf(RED"WARNING: LSB plane looks random, likely already stego or will be flagged\n"RESET);
+}
+
+/* Master analysis process */
+Status do_analysis(AnalyzeInfo *anInfo)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // 1. Open image
+    printf(YELLOW"INFO: Opening image\n"RESET);
+    if (is_stream_fname(anInfo->image_fname))
+        anInfo->fptr_image = stdin;
+    else
+        anInfo->fptr_image = fopen(anInfo->image_fname, "r");
+    if (anInfo->fptr_image == NULL)
+    {
+        perror(RED"ERROR: Unable to open image"RESET);
+        return failure;
+    }
+    printf(GREEN"SUCCESS: Opened image\n"RESET);
+
+    // 2. Read BMP header
+    printf(YELLOW"INFO: Reading BMP header\n"RESET);
+    if (read_bmp_header(anInfo->fptr_image, anInfo->bmp_header) == failure)
+        return failure;
+
+    uint bpp;
+    get_bmp_dimensions(anInfo->bmp_header, &anInfo->width, &anInfo->height, &bpp);
+    printf(MAGENTA"     Width = "RESET BOLD"%u pxls\n"RESET, anInfo->width);
+    printf(MAGENTA"     Height = "RESET BOLD"%u pxls\n"RESET, anInfo->height);
+    if (bpp != 24 && bpp != 32)
+    {
+        fprintf(stderr, RED"ERROR: Only 24 and 32 bpp images can be analysed (got %u)\n"RESET, bpp);
+        return failure;
+    }
+    anInfo->bytes_per_pixel = bpp / 8;
+    anInfo->row_stride = get_row_stride(anInfo->bmp_header);
+    printf(GREEN"SUCCESS: Read BMP header\n"RESET);
+
+    // 3. Scan pixel array
+    printf(YELLOW"INFO: Scanning pixel array\n"RESET);
+    if (scan_pixel_array(anInfo) == failure)
+        return failure;
+    printf(GREEN"SUCCESS: Scanned pixel array\n"RESET);
+
+    // 4. Statistics
+    compute_chi_square(anInfo);
+    compute_rs_estimate(anInfo);
+
+    double risk = 0;
+    for (int c = 0; c < ANALYZE_CHANNELS; c++)
+    {
+        if (anInfo->chi_p[c] > risk)
+            risk = anInfo->chi_p[c];
+        if (anInfo->rs_estimate[c] > risk)
+            risk = anInfo->rs_estimate[c];
+    }
+    anInfo->score = 100 * (1 - risk);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf(MAGENTA"INFO: Analysed "RESET BOLD"%.1f MP"RESET MAGENTA" in "RESET BOLD"%.3f s\n"RESET,
+           (double)anInfo->width * anInfo->height / 1e6, seconds);
+
+    print_analysis_report(anInfo);
+
+    if (anInfo->fptr_image != stdin)
+        fclose(anInfo->fptr_image);
+    return success;
+}
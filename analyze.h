@@ -0,0 +1,61 @@
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include <stdio.h>
+#include "types.h"  // Contains user defined types
+#include "common.h" // Contains BMP_HEADER_SIZE
+
+/* Number of colour channels analysed (B, G, R; alpha is ignored) */
+#define ANALYZE_CHANNELS 3
+
+/* RS counters: R_M, S_M, R_-M, S_-M on the image, then on the image with all LSBs flipped */
+#define RS_COUNTERS 8
+
+/*
+ * Structure to store information required for
+ * the LSB-plane steganalysis of an image, and its results
+ */
+typedef struct _AnalyzeInfo
+{
+    /* Image info */
+    char *image_fname;                // To store the image name
+    FILE *fptr_image;                 // To store the address of the image
+    char bmp_header[BMP_HEADER_SIZE]; // To store the BMP header
+    uint width;                       // Width in pixels
+    uint height;                      // Height in pixels
+    uint bytes_per_pixel;             // 3 for 24 bpp, 4 for 32 bpp
+    uint row_stride;                  // Bytes per row including padding
+
+    /* Results */
+    unsigned long long hist[ANALYZE_CHANNELS][256];              // Value histogram per channel
+    unsigned long long lsb_ones[ANALYZE_CHANNELS];               // Bytes with LSB set per channel
+    unsigned long long samples[ANALYZE_CHANNELS];                // Bytes seen per channel
+    unsigned long long rs_counts[ANALYZE_CHANNELS][RS_COUNTERS]; // RS group counters per channel
+    double chi_square[ANALYZE_CHANNELS];                         // Chi-square of the pairs of values
+    double chi_p[ANALYZE_CHANNELS];                              // Probability that the LSBs are embedded
+    double rs_estimate[ANALYZE_CHANNELS];                        // Estimated embedded fraction (0..1)
+    double score;                                                // Cover suitability 0..100
+
+} AnalyzeInfo;
+
+/* Analyze function prototypes */
+
+/* Read and validate Analyze args from argv */
+Status read_and_validate_analyze_args(char *argv[], AnalyzeInfo *anInfo);
+
+/* Perform the analysis */
+Status do_analysis(AnalyzeInfo *anInfo);
+
+/* Stream the pixel array and collect histogram and RS counts */
+Status scan_pixel_array(AnalyzeInfo *anInfo);
+
+/* Chi-square attack on the pairs of values of each channel */
+Status compute_chi_square(AnalyzeInfo *anInfo);
+
+/* Estimate the embedded fraction from the RS counts */
+Status compute_rs_estimate(AnalyzeInfo *anInfo);
+
+/* Print the report */
+void print_analysis_report(AnalyzeInfo *anInfo);
+
+#endif
@@ -0,0 +1,564 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "archive.h"
+#include "encode.h"
+#include "decode.h"
+#include "stream.h"
+#include "cache.h"
+#include "colour.h"
+
+/* Payload bytes handled per read/write */
+#define ARCHIVE_CHUNK 512
+
+/* Size of one table entry without the name: name length, offset, length, flags */
+#define ENTRY_FIXED_SIZE (1 + 4 + 4 + 1)
+
+/* Function Definitions */
+
+// Hide len payload bytes in the next len * 8 image bytes
+static Status archive_write_bytes(ArchiveInfo *arcInfo, const char *data, uint len)
+{
+    char buffer[ARCHIVE_CHUNK * 8];
+    while (len > 0)
+    {
+        uint n = len < ARCHIVE_CHUNK ? len : ARCHIVE_CHUNK;
+        if (fread(buffer, 8, n, arcInfo->fptr_src_image) != n)
+            return failure;
+        for (uint i = 0; i < n; i++)
+            encode_byte_to_lsb(data[i], buffer + i * 8);
+        if (fwrite(buffer, 8, n, arcInfo->fptr_stego_image) != n)
+            return failure;
+        data += n;
+        len -= n;
+    }
+    return success;
+}
+
+// Hide a 4 byte value in the next 32 image bytes
+static Status archive_write_word(ArchiveInfo *arcInfo, uint value)
+{
+    char buffer[32];
+    if (fread(buffer, 32, 1, arcInfo->fptr_src_image) != 1)
+        return failure;
+    encode_size_to_lsb(value, buffer);
+    if (fwrite(buffer, 32, 1, arcInfo->fptr_stego_image) != 1)
+        return failure;
+    return success;
+}
+
+// Get len payload bytes back from the next len * 8 image bytes
+static Status archive_read_bytes(ArchiveInfo *arcInfo, char *data, uint len)
+{
+    FILE *fptr_image = arcInfo->fptr_src_image;
+    if (arcInfo->src_cache != NULL)
+        return read_cached_payload(arcInfo->src_cache, fptr_image, data, len);
+
+    char buffer[ARCHIVE_CHUNK * 8];
+    while (len > 0)
+    {
+        uint n = len < ARCHIVE_CHUNK ? len : ARCHIVE_CHUNK;
+        if (fread(buffer, 8, n, fptr_image) != n)
+            return failure;
+        for (uint i = 0; i < n; i++)
+            decode_byte_from_lsb(buffer + i * 8, &data[i]);
+        data += n;
+        len -= n;
+    }
+    return success;
+}
+
+// Get a 4 byte value back from the next 32 image bytes, MSB first
+static Status archive_read_word(ArchiveInfo *arcInfo, uint *value)
+{
+    unsigned char word[4];
+    if (archive_read_bytes(arcInfo, (char *)word, 4) == failure)
+        return failure;
+    *value = ((uint)word[0] << 24) | ((uint)word[1] << 16) | ((uint)word[2] << 8) | word[3];
+    return success;
+}
+
+/* Read and validate archive encode arguments
+ * Description: argv[2] is the cover, the last argument is the output if
+ * it is a .bmp (or "-"), everything in between is a file to embed.
+ */
+Status read_and_validate_archive_args(int argc, char *argv[], ArchiveInfo *arcInfo)
+{
+    printf(YELLOW "INFO: Checking source image extension\n" RESET);
+    char *img_dot = strrchr(argv[2], '.');
+    if (!is_stream_fname(argv[2]) && (img_dot == NULL || strcmp(img_dot, ".bmp") != 0))
+    {
+        printf(RED "ERROR: Source image file must be .bmp\n" RESET);
+        return failure;
+    }
+    arcInfo->src_image_fname = argv[2];
+    printf(GREEN "SUCCESS: Valid extension\n" RESET);
+
+    int last = argc - 1;
+    char *o_dot = strrchr(argv[last], '.');
+    if (is_stream_fname(argv[last]) || (o_dot != NULL && strcmp(o_dot, ".bmp") == 0))
+        arcInfo->stego_image_fname = argv[last--];
+    else
+        arcInfo->stego_image_fname = "steg.bmp";
+
+    int count = last - 2;
+    if (count < 1 || count > ARCHIVE_MAX_FILES)
+    {
+        printf(RED "ERROR: Number of files must be 1 to %d\n" RESET, ARCHIVE_MAX_FILES);
+        return failure;
+    }
+
+    arcInfo->entries = calloc(count, sizeof(ArchiveEntry));
+    if (arcInfo->entries == NULL)
+        return failure;
+    arcInfo->count = count;
+
+    printf(YELLOW "INFO: Checking files to embed\n" RESET);
+    for (int i = 0; i < count; i++)
+    {
+        ArchiveEntry *entry = &arcInfo->entries[i];
+        entry->fname = argv[3 + i];
+
+        // Only the base name goes in the table
+        char *base = strrchr(entry->fname, '/');
+        base = base ? base + 1 : entry->fname;
+        if (base[0] == '\0' || strlen(base) > ARCHIVE_MAX_NAME)
+        {
+            printf(RED "ERROR: Invalid file name: %s\n" RESET, entry->fname);
+            return failure;
+        }
+        strcpy(entry->name, base);
+
+        for (int j = 0; j < i; j++)
+        {
+            if (strcmp(arcInfo->entries[j].name, entry->name) == 0)
+            {
+                printf(RED "ERROR: Duplicate file name in archive: %s\n" RESET, entry->name);
+                return failure;
+            }
+        }
+    }
+    printf(GREEN "SUCCESS: %d files to embed\n" RESET, count);
+
+    return success;
+}
+
+/* Read and validate archive decode arguments */
+Status read_and_validate_archive_decode_args(int argc, char *argv[], ArchiveInfo *arcInfo)
+{
+    char *dot = strrchr(argv[2], '.');
+    if (!is_stream_fname(argv[2]) && (dot == NULL || strcmp(dot, ".bmp") != 0))
+    {
+        printf(RED "ERROR: Invalid source file. Use .bmp files.\n" RESET);
+        return failure;
+    }
+    arcInfo->src_image_fname = argv[2];
+
+    if (strcmp(argv[3], "--list") == 0)
+        return argc == 4 ? success : failure;
+
+    if (strcmp(argv[3], "--extract") != 0 || argc > 6)
+        return failure;
+
+    arcInfo->extract_name = argc > 4 ? argv[4] : NULL;
+    arcInfo->output_fname = argc > 5 ? argv[5] : NULL;
+    return success;
+}
+
+// Fill in sizes, offsets and flags from the files on disk
+static Status stat_archive_files(ArchiveInfo *arcInfo)
+{
+    // The table stores offsets and lengths as 32-bit words
+    unsigned long long offset = 0;
+    for (uint i = 0; i < arcInfo->count; i++)
+    {
+        ArchiveEntry *entry = &arcInfo->entries[i];
+        struct stat st;
+        if (stat(entry->fname, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            fprintf(stderr, RED "ERROR: %s is not a readable regular file\n" RESET, entry->fname);
+            return failure;
+        }
+
+        if ((unsigned long long)st.st_size > UINT_MAX || offset + st.st_size > UINT_MAX)
+        {
+            fprintf(stderr, RED "ERROR: %s does not fit in an archive, files are limited to 4 GB in total\n" RESET, entry->fname);
+            return failure;
+        }
+
+        entry->offset = (uint)offset;
+        entry->length = (uint)st.st_size;
+        entry->flags = (st.st_mode & S_IXUSR) ? ARCHIVE_FLAG_EXEC : 0;
+        offset += entry->length;
+    }
+    return success;
+}
+
+// Payload bytes taken by the magic string, count and directory table
+static unsigned long long get_table_size(ArchiveInfo *arcInfo)
+{
+    unsigned long long size = strlen(ARCHIVE_MAGIC) + 4;
+    for (uint i = 0; i < arcInfo->count; i++)
+        size += ENTRY_FIXED_SIZE + strlen(arcInfo->entries[i].name);
+    return size;
+}
+
+// Hide the directory table
+static Status encode_archive_table(ArchiveInfo *arcInfo)
+{
+    if (archive_write_bytes(arcInfo, ARCHIVE_MAGIC, strlen(ARCHIVE_MAGIC)) == failure)
+        return failure;
+    if (archive_write_word(arcInfo, arcInfo->count) == failure)
+        return failure;
+
+    for (uint i = 0; i < arcInfo->count; i++)
+    {
+        ArchiveEntry *entry = &arcInfo->entries[i];
+        char name_len = (char)strlen(entry->name);
+        char flags = (char)entry->flags;
+
+        if (archive_write_bytes(arcInfo, &name_len, 1) == failure ||
+            archive_write_bytes(arcInfo, entry->name, (unsigned char)name_len) == failure ||
+            archive_write_word(arcInfo, entry->offset) == failure ||
+            archive_write_word(arcInfo, entry->length) == failure ||
+            archive_write_bytes(arcInfo, &flags, 1) == failure)
+            return failure;
+    }
+    return success;
+}
+
+// Hide the data of every file, back to back
+static Status encode_archive_data(ArchiveInfo *arcInfo)
+{
+    char data[ARCHIVE_CHUNK];
+    for (uint i = 0; i < arcInfo->count; i++)
+    {
+        ArchiveEntry *entry = &arcInfo->entries[i];
+        FILE *fptr = fopen(entry->fname, "r");
+        if (fptr == NULL)
+        {
+            perror(RED "ERROR: Unable to open file to embed" RESET);
+            return failure;
+        }
+
+        uint left = entry->length;
+        while (left > 0)
+        {
+            uint n = left < ARCHIVE_CHUNK ? left : ARCHIVE_CHUNK;
+            if (fread(data, 1, n, fptr) != n || archive_write_bytes(arcInfo, data, n) == failure)
+            {
+                fprintf(stderr, RED "ERROR: Failed to embed %s\n" RESET, entry->fname);
+                fclose(fptr);
+                return failure;
+            }
+            left -= n;
+        }
+        fclose(fptr);
+        printf(GREEN "SUCCESS: Embedded " RESET BOLD "%s" RESET GREEN " (%u bytes)\n" RESET, entry->name, entry->length);
+    }
+    return success;
+}
+
+/* Encode all files with a directory table */
+Status do_archive_encoding(ArchiveInfo *arcInfo)
+{
+    // 1. Open files
+    printf(YELLOW "INFO: Opening files\n" RESET);
+    if (stat_archive_files(arcInfo) == failure)
+        return failure;
+
+    if (is_stream_fname(arcInfo->src_image_fname))
+        arcInfo->fptr_src_image = stdin;
+    else
+        arcInfo->fptr_src_image = fopen(arcInfo->src_image_fname, "r");
+    if (arcInfo->fptr_src_image == NULL)
+    {
+        perror(RED "ERROR: Unable to open source image file" RESET);
+        return failure;
+    }
+
+    arcInfo->fptr_stego_image = open_output(&arcInfo->stego_output, arcInfo->stego_image_fname, NULL, 0);
+    if (arcInfo->fptr_stego_image == NULL)
+    {
+        perror(RED "ERROR: Unable to open output file" RESET);
+        return failure;
+    }
+    printf(GREEN "SUCCESS: Opening files done\n" RESET);
+
+    // 2. Check capacity
+    printf(YELLOW "INFO: Checking capacity\n" RESET);
+    if (read_bmp_header(arcInfo->fptr_src_image, arcInfo->bmp_header) == failure)
+        return failure;
+    arcInfo->image_capacity = get_image_size_from_header(arcInfo->bmp_header);
+
+    unsigned long long payload = get_table_size(arcInfo);
+    for (uint i = 0; i < arcInfo->count; i++)
+        payload += arcInfo->entries[i].length;
+    if (payload * 8 > arcInfo->image_capacity)
+    {
+        printf(RED "ERROR: Image does not have enough capacity: " RESET);
+        printf("%llu bytes/%llu bytes\n", payload * 8, arcInfo->image_capacity);
+        return failure;
+    }
+    printf(GREEN "SUCCESS: Check capacity done\n" RESET);
+
+    // 3. Copy BMP header
+    printf(YELLOW "INFO: Copying BMP header\n" RESET);
+    if (copy_bmp_header(arcInfo->bmp_header, arcInfo->fptr_stego_image) == failure)
+        return failure;
+    printf(GREEN "SUCCESS: Copying BMP header done\n" RESET);
+
+    // 4. Directory table
+    printf(YELLOW "INFO: Encoding directory table\n" RESET);
+    if (encode_archive_table(arcInfo) == failure)
+    {
+        fprintf(stderr, RED "ERROR: Failed to encode directory table\n" RESET);
+        return failure;
+    }
+    printf(GREEN "SUCCESS: Encoding directory table done\n" RESET);
+
+    // 5. File data
+    printf(YELLOW "INFO: Encoding file data\n" RESET);
+    if (encode_archive_data(arcInfo) == failure)
+        return failure;
+    printf(GREEN "SUCCESS: Encoding file data done\n" RESET);
+
+    // 6. Copy remaining image data
+    printf(YELLOW "INFO: Copying remaining Image data\n" RESET);
+    if (copy_remaining_img_data(arcInfo->fptr_src_image, arcInfo->fptr_stego_image) == failure)
+    {
+        fprintf(stderr, RED "ERROR: Failed to copy remaining image data\n" RESET);
+        return failure;
+    }
+    printf(GREEN "SUCCESS: Copying remaining Image data done\n" RESET);
+
+    // 7. Flush, sync and move the stego image into place
+    arcInfo->fptr_stego_image = NULL;
+    if (commit_output(&arcInfo->stego_output) == failure)
+    {
+        fprintf(stderr, RED "ERROR: Unable to write stego image\n" RESET);
+        return failure;
+    }
+    return success;
+}
+
+/* Decode only the directory table
+ * Description: Reads the header, magic string, count and table entries,
+ * and leaves the image positioned at the first data byte. A stream the
+ * caller opened already is used as it is.
+ */
+Status decode_archive_table(ArchiveInfo *arcInfo)
+{
+    // Only the LSBs are needed, so the sidecar is as good as the image
+    if (arcInfo->fptr_src_image != NULL)
+        ; // Opened by the caller
+    else if (is_stream_fname(arcInfo->src_image_fname))
+        arcInfo->fptr_src_image = stdin;
+    else
+        arcInfo->fptr_src_image = open_stego_image(arcInfo->src_image_fname, &arcInfo->src_cache);
+    if (arcInfo->fptr_src_image == NULL)
+    {
+        perror(RED "ERROR: Unable to open source image file" RESET);
+        return failure;
+    }
+
+    if (read_bmp_header(arcInfo->fptr_src_image, arcInfo->bmp_header) == failure)
+        return failure;
+    arcInfo->image_capacity = get_image_size_from_header(arcInfo->bmp_header);
+
+    char magic[sizeof(ARCHIVE_MAGIC)] = {0};
+    if (archive_read_bytes(arcInfo, magic, strlen(ARCHIVE_MAGIC)) == failure)
+        return failure;
+    if (strcmp(magic, ARCHIVE_MAGIC) != 0)
+    {
+        if (strcmp(magic, MAGIC_STRING) == 0)
+            fprintf(stderr, RED "ERROR: Image holds a single file, decode it without --list/--extract\n" RESET);
+        else
+            fprintf(stderr, RED "ERROR: Archive magic string not found!\n" RESET);
+        return failure;
+    }
+
+    if (archive_read_word(arcInfo, &arcInfo->count) == failure)
+        return failure;
+    if (arcInfo->count < 1 || arcInfo->count > ARCHIVE_MAX_FILES)
+    {
+        fprintf(stderr, RED "ERROR: Decoded file count invalid: %u\n" RESET, arcInfo->count);
+        return failure;
+    }
+
+    arcInfo->entries = calloc(arcInfo->count, sizeof(ArchiveEntry));
+    if (arcInfo->entries == NULL)
+        return failure;
+
+    for (uint i = 0; i < arcInfo->count; i++)
+    {
+        ArchiveEntry *entry = &arcInfo->entries[i];
+        char name_len, flags;
+
+        if (archive_read_bytes(arcInfo, &name_len, 1) == failure ||
+            archive_read_bytes(arcInfo, entry->name, (unsigned char)name_len) == failure ||
+            archive_read_word(arcInfo, &entry->offset) == failure ||
+            archive_read_word(arcInfo, &entry->length) == failure ||
+            archive_read_bytes(arcInfo, &flags, 1) == failure)
+        {
+            fprintf(stderr, RED "ERROR: Directory table is truncated\n" RESET);
+            return failure;
+        }
+        entry->name[(unsigned char)name_len] = '\0';
+        entry->flags = (unsigned char)flags;
+
+        // Never trust names that could escape the current directory
+        if (name_len == 0 || strlen(entry->name) != (unsigned char)name_len ||
+            strchr(entry->name, '/') != NULL ||
+            strcmp(entry->name, ".") == 0 || strcmp(entry->name, "..") == 0)
+        {
+            fprintf(stderr, RED "ERROR: Invalid file name in directory table\n" RESET);
+            return failure;
+        }
+    }
+
+    // Every entry must lie inside the image
+    unsigned long long table_size = get_table_size(arcInfo);
+    for (uint i = 0; i < arcInfo->count; i++)
+    {
+        ArchiveEntry *entry = &arcInfo->entries[i];
+        if ((table_size + entry->offset + entry->length) * 8 > arcInfo->image_capacity)
+        {
+            fprintf(stderr, RED "ERROR: Entry %s lies outside the image\n" RESET, entry->name);
+            return failure;
+        }
+    }
+
+    arcInfo->data_start = BMP_HEADER_SIZE + (long)table_size * 8;
+    return success;
+}
+
+/* Print the directory table */
+Status do_archive_list(ArchiveInfo *arcInfo)
+{
+    printf(YELLOW "INFO: Decoding directory table\n" RESET);
+    if (decode_archive_table(arcInfo) == failure)
+        return failure;
+    printf(GREEN "SUCCESS: Decoded directory table\n" RESET);
+
+    printf(BOLD "%-32s %10s %10s  %s\n" RESET, "Name", "Offset", "Length", "Flags");
+    for (uint i = 0; i < arcInfo->count; i++)
+    {
+        ArchiveEntry *entry = &arcInfo->entries[i];
+        printf("%-32s %10u %10u  %s\n", entry->name, entry->offset, entry->length,
+               (entry->flags & ARCHIVE_FLAG_EXEC) ? "x" : "-");
+    }
+    return success;
+}
+
+// Move to an image offset; pipes can only skip forward by reading
+static Status archive_seek(ArchiveInfo *arcInfo, long position, long *current)
+{
+    if (fseek(arcInfo->fptr_src_image, position, SEEK_SET) == 0)
+    {
+        *current = position;
+        return success;
+    }
+
+    char buffer[4096];
+    while (*current < position)
+    {
+        long n = position - *current < (long)sizeof(buffer) ? position - *current : (long)sizeof(buffer);
+        if (fread(buffer, 1, n, arcInfo->fptr_src_image) != (size_t)n)
+            return failure;
+        *current += n;
+    }
+    return *current == position ? success : failure;
+}
+
+// Decode one entry straight from its pixel range
+static Status extract_archive_entry(ArchiveInfo *arcInfo, ArchiveEntry *entry, const char *output_fname, long *current)
+{
+    if (archive_seek(arcInfo, arcInfo->data_start + (long)entry->offset * 8, current) == failure)
+    {
+        fprintf(stderr, RED "ERROR: Unable to reach data of %s\n" RESET, entry->name);
+        return failure;
+    }
+
+    OutputFile output;
+    FILE *fptr = open_output(&output, output_fname, NULL, 0);
+    if (fptr == NULL)
+    {
+        perror(RED "ERROR: Unable to open output file" RESET);
+        return failure;
+    }
+
+    char data[ARCHIVE_CHUNK];
+    uint left = entry->length;
+    while (left > 0)
+    {
+        uint n = left < ARCHIVE_CHUNK ? left : ARCHIVE_CHUNK;
+        if (archive_read_bytes(arcInfo, data, n) == failure ||
+            fwrite(data, 1, n, fptr) != n)
+        {
+            fprintf(stderr, RED "ERROR: Failed to extract %s\n" RESET, entry->name);
+            abort_output(&output);
+            return failure;
+        }
+        left -= n;
+        *current += (long)n * 8;
+    }
+
+    if ((entry->flags & ARCHIVE_FLAG_EXEC) && !is_stream_fname(output_fname))
+        chmod_output(&output, 0755);
+    if (commit_output(&output) == failure)
+    {
+        fprintf(stderr, RED "ERROR: Unable to write %s\n" RESET, output_fname);
+        return failure;
+    }
+
+    printf(GREEN "SUCCESS: Extracted " RESET BOLD "%s" RESET GREEN " (%u bytes)\n" RESET, output_fname, entry->length);
+    return success;
+}
+
+/* Extract one file (or all of them) */
+Status do_archive_extract(ArchiveInfo *arcInfo)
+{
+    printf(YELLOW "INFO: Decoding directory table\n" RESET);
+    if (decode_archive_table(arcInfo) == failure)
+        return failure;
+    printf(GREEN "SUCCESS: Decoded directory table\n" RESET);
+
+    long current = arcInfo->data_start;
+    int found = 0;
+    for (uint i = 0; i < arcInfo->count; i++)
+    {
+        ArchiveEntry *entry = &arcInfo->entries[i];
+        if (arcInfo->extract_name != NULL && strcmp(entry->name, arcInfo->extract_name) != 0)
+            continue;
+
+        found = 1;
+        const char *output = arcInfo->output_fname ? arcInfo->output_fname : entry->name;
+        if (extract_archive_entry(arcInfo, entry, output, &current) == failure)
+            return failure;
+        if (arcInfo->extract_name != NULL)
+            break;
+    }
+
+    if (!found)
+    {
+        fprintf(stderr, RED "ERROR: %s not found in archive\n" RESET, arcInfo->extract_name);
+        return failure;
+    }
+    return success;
+}
+
+/* Release the table and close the source image */
+void free_archive(ArchiveInfo *arcInfo)
+{
+    abort_output(&arcInfo->stego_output); // Removes an unfinished stego image
+    if (arcInfo->fptr_src_image != NULL && arcInfo->fptr_src_image != stdin)
+        fclose(arcInfo->fptr_src_image);
+    arcInfo->fptr_src_image = NULL;
+    arcInfo->src_cache = NULL; // Freed with the stream
+    free(arcInfo->entries);
+    arcInfo->entries = NULL;
+    arcInfo->count = 0;
+}
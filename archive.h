@@ -0,0 +1,84 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdio.h>
+#include "types.h"  // Contains user defined types
+#include "common.h" // Contains BMP_HEADER_SIZE
+#include "output.h" // Contains OutputFile
+#include "cache.h"  // Contains CacheReader
+
+/* Limits on the directory table, also used to reject hostile images */
+#define ARCHIVE_MAX_FILES 1024
+#define ARCHIVE_MAX_NAME 255
+
+/* Entry flags */
+#define ARCHIVE_FLAG_EXEC 0x01 // File was executable (e.g. a .sh script)
+
+/*
+ * Layout after the BMP header, every byte hidden in 8 image bytes:
+ *   ARCHIVE_MAGIC | file count (4 bytes) |
+ *   count x { name length (1) | name | offset (4) | length (4) | flags (1) } |
+ *   file data packed back to back (offsets are relative to the first one)
+ */
+typedef struct _ArchiveEntry
+{
+    char name[ARCHIVE_MAX_NAME + 1]; // Name stored in the table (no directories)
+    char *fname;                     // Path on disk (encoding only)
+    uint offset;                     // Offset of the data in the data region
+    uint length;                     // Size of the data
+    uint flags;                      // ARCHIVE_FLAG_*
+} ArchiveEntry;
+
+/*
+ * Structure to store information required for
+ * encoding several files into one image, or listing/extracting them
+ */
+typedef struct _ArchiveInfo
+{
+    /* Source Image info */
+    char *src_image_fname;            // To store the src (cover or stego) image name
+    FILE *fptr_src_image;             // To store the address of the src image
+    CacheReader *src_cache;           // Set when fptr_src_image reads the LSB cache sidecar
+    char bmp_header[BMP_HEADER_SIZE]; // To store the BMP header
+    unsigned long long image_capacity; // To store the size of image
+
+    /* Directory table */
+    ArchiveEntry *entries; // To store the table entries
+    uint count;            // Number of entries
+    long data_start;       // Image offset of the first data byte (decoding only)
+
+    /* Stego Image Info (encoding only) */
+    char *stego_image_fname; // To store the dest file name
+    FILE *fptr_stego_image;  // To store the address of stego image
+    OutputFile stego_output; // Temporary file renamed to the dest name when done
+
+    /* Extraction (decoding only) */
+    char *extract_name; // Name to extract, NULL for all
+    char *output_fname; // Output name, NULL to use the stored name
+
+} ArchiveInfo;
+
+/* Archive function prototypes */
+
+/* Read and validate archive encode args: -e <cover.bmp> <file>... [output.bmp] */
+Status read_and_validate_archive_args(int argc, char *argv[], ArchiveInfo *arcInfo);
+
+/* Read and validate archive decode args: -d <stego.bmp> --list | --extract [NAME [output]] */
+Status read_and_validate_archive_decode_args(int argc, char *argv[], ArchiveInfo *arcInfo);
+
+/* Encode all files with a directory table */
+Status do_archive_encoding(ArchiveInfo *arcInfo);
+
+/* Decode only the directory table */
+Status decode_archive_table(ArchiveInfo *arcInfo);
+
+/* Print the directory table */
+Status do_archive_list(ArchiveInfo *arcInfo);
+
+/* Extract one file (or all of them) */
+Status do_archive_extract(ArchiveInfo *arcInfo);
+
+/* Release the table and close the source image */
+void free_archive(ArchiveInfo *arcInfo);
+
+#endif
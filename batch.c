@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "encode.h"
+#include "decode.h"
+#include "parallel.h"
+#include "output.h"
+#include "common.h"
+#include "colour.h"
+
+/* Arguments handed to one worker thread */
+typedef struct _BatchWorker
+{
+    BatchInfo *batchInfo;
+    int id;
+} BatchWorker;
+
+/* Function Definitions */
+
+// Seconds from a monotonic clock
+static double get_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Fill one job from the words of a manifest line; an invalid line gives an unsupported job
+static Status parse_batch_line(BatchJob *job, char *line)
+{
+    char *words[4];
+    int nwords = 0;
+    char *save = NULL;
+
+    for (char *word = strtok_r(line, " \t\r\n", &save); word != NULL; word = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if (nwords == 4)
+        {
+            nwords++;
+            break;
+        }
+        words[nwords++] = word;
+    }
+
+    job->op = unsupported;
+    job->argv[0] = "steg";
+    if (nwords < 2 || nwords > 4)
+        return success;
+
+    if (strcmp(words[0], "e") == 0 || strcmp(words[0], "-e") == 0 || strcmp(words[0], "encode") == 0)
+    {
+        if (nwords < 3)
+            return success;
+        job->op = encode;
+        job->argv[1] = "-e";
+    }
+    else if (strcmp(words[0], "d") == 0 || strcmp(words[0], "-d") == 0 || strcmp(words[0], "decode") == 0)
+    {
+        if (nwords > 3)
+            return success;
+        job->op = decode;
+        job->argv[1] = "-d";
+    }
+    else
+        return success;
+
+    for (int i = 1; i < nwords; i++)
+    {
+        job->argv[i + 1] = strdup(words[i]);
+        if (job->argv[i + 1] == NULL)
+        {
+            fprintf(stderr, RED"ERROR: Out of memory on manifest line %d\n"RESET, job->line);
+            job->op = unsupported;
+            return failure;
+        }
+    }
+    return success;
+}
+
+/* Read and parse the manifest */
+Status read_batch_manifest(BatchInfo *batchInfo)
+{
+    FILE *fptr = fopen(batchInfo->manifest_fname, "r");
+    if (fptr == NULL)
+    {
+        perror(RED"ERROR: Unable to open manifest"RESET);
+        return failure;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    int capacity = 0;
+    int line_no = 0;
+
+    while (getline(&line, &line_size, fptr) != -1)
+    {
+        line_no++;
+        char *p = line + strspn(line, " \t\r\n");
+        if (*p == '\0' || *p == '#')
+            continue;
+
+        if (batchInfo->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            BatchJob *jobs = realloc(batchInfo->jobs, capacity * sizeof(BatchJob));
+            if (jobs == NULL)
+            {
+                free(line);
+                fclose(fptr);
+                return failure;
+            }
+            batchInfo->jobs = jobs;
+        }
+
+        BatchJob *job = &batchInfo->jobs[batchInfo->count++];
+        memset(job, 0, sizeof(*job));
+        job->line = line_no;
+        if (parse_batch_line(job, p) == failure)
+        {
+            free(line);
+            fclose(fptr);
+            return failure;
+        }
+    }
+
+    free(line);
+    fclose(fptr);
+    return success;
+}
+
+/* Run one job with the given per-thread I/O buffer
+ * Description: Same steps as a single ./steg run; every file the job
+ * opened is closed whatever the outcome, so the next job can reuse the
+ * buffer.
+ */
+Status run_batch_job(BatchJob *job, char *io_buffer)
+{
+    // An input may be an earlier job's output still waiting for its group sync
+    int ninputs = job->op == encode ? 2 : 1;
+    for (int i = 2; i < 2 + ninputs && job->argv[i] != NULL; i++)
+        if (flush_pending_output(job->argv[i]) == failure)
+            return failure;
+
+    struct stat st;
+    if (job->argv[2] != NULL && stat(job->argv[2], &st) == 0)
+        job->bytes = st.st_size;
+
+    if (job->op == encode)
+    {
+        EncodeInfo encInfo = {0};
+        encInfo.io_buffer = io_buffer;
+        Status status = read_and_validate_encode_args(job->argv, &encInfo);
+        if (status == success)
+            status = do_encoding(&encInfo);
+        close_encode_files(&encInfo);
+        if (encInfo.stego_image_fname != NULL)
+            snprintf(job->result_fname, sizeof(job->result_fname), "%s", encInfo.stego_image_fname);
+        return status;
+    }
+
+    if (job->op == decode)
+    {
+        DecodeInfo decInfo = {0};
+        decInfo.io_buffer = io_buffer;
+        Status status = read_and_validate_decode_args(job->argv, &decInfo);
+        if (status == success)
+            status = do_decoding(&decInfo);
+        close_decode_files(&decInfo);
+        snprintf(job->result_fname, sizeof(job->result_fname), "%s", decInfo.secret_fname);
+        return status;
+    }
+
+    return failure;
+}
+
+// Take a job from the worker's own queue, in manifest order
+static int pop_own_job(WorkQueue *queue)
+{
+    int job = -1;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail > queue->head)
+        job = queue->jobs[queue->head++];
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+// Take the last job of another worker, the one its owner would reach last
+static int steal_job(BatchInfo *batchInfo, int id)
+{
+    for (int k = 1; k < batchInfo->nworkers; k++)
+    {
+        WorkQueue *queue = &batchInfo->queues[(id + k) % batchInfo->nworkers];
+        int job = -1;
+        pthread_mutex_lock(&queue->lock);
+        if (queue->tail > queue->head)
+            job = queue->jobs[--queue->tail];
+        pthread_mutex_unlock(&queue->lock);
+        if (job >= 0)
+            return job;
+    }
+    return -1;
+}
+
+// Print the status of one job and add it to the totals
+static void report_batch_job(BatchInfo *batchInfo, BatchJob *job)
+{
+    pthread_mutex_lock(&batchInfo->lock);
+    if (job->status == success)
+    {
+        batchInfo->ok++;
+        batchInfo->bytes += job->bytes;
+    }
+    else
+        batchInfo->failed++;
+
+    fprintf(batchInfo->fptr_report, "%s line %d:", job->status == success ? GREEN"[ok]    "RESET : RED"[FAILED]"RESET, job->line);
+    for (int i = 1; i < 5 && job->argv[i] != NULL; i++)
+        fprintf(batchInfo->fptr_report, " %s", job->argv[i]);
+    if (job->op == unsupported)
+        fprintf(batchInfo->fptr_report, " (invalid manifest line)");
+    fprintf(batchInfo->fptr_report, " (%.3f s)\n", job->seconds);
+    pthread_mutex_unlock(&batchInfo->lock);
+}
+
+// Worker thread: own jobs first, then steal until every queue is empty
+static void *batch_worker(void *arg)
+{
+    BatchWorker *worker = arg;
+    BatchInfo *batchInfo = worker->batchInfo;
+    char *io_buffer = malloc(2 * IO_BUFFER_SIZE);
+
+    for (;;)
+    {
+        int index = pop_own_job(&batchInfo->queues[worker->id]);
+        if (index < 0)
+            index = steal_job(batchInfo, worker->id);
+        if (index < 0)
+            break;
+
+        BatchJob *job = &batchInfo->jobs[index];
+        double start = get_seconds();
+        job->status = run_batch_job(job, io_buffer);
+        job->seconds = get_seconds() - start;
+        report_batch_job(batchInfo, job);
+    }
+
+    free(io_buffer);
+    return NULL;
+}
+
+/* Run every job on the work-stealing pool and print the report */
+Status do_batch(BatchInfo *batchInfo)
+{
+    int nworkers = get_thread_count();
+    if (nworkers > batchInfo->count)
+        nworkers = batchInfo->count > 0 ? batchInfo->count : 1;
+    batchInfo->nworkers = nworkers;
+
+    batchInfo->queues = calloc(nworkers, sizeof(WorkQueue));
+    if (batchInfo->queues == NULL)
+        return failure;
+    pthread_mutex_init(&batchInfo->lock, NULL);
+
+    // Deal the jobs out round-robin
+    int per_queue = (batchInfo->count + nworkers - 1) / nworkers;
+    for (int w = 0; w < nworkers; w++)
+    {
+        pthread_mutex_init(&batchInfo->queues[w].lock, NULL);
+        batchInfo->queues[w].jobs = malloc((per_queue > 0 ? per_queue : 1) * sizeof(int));
+        if (batchInfo->queues[w].jobs == NULL)
+            return failure;
+    }
+    for (int i = 0; i < batchInfo->count; i++)
+    {
+        WorkQueue *queue = &batchInfo->queues[i % nworkers];
+        queue->jobs[queue->tail++] = i;
+    }
+
+    double start = get_seconds();
+    BatchWorker workers[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    int started[MAX_THREADS] = {0};
+
+    for (int w = 1; w < nworkers; w++)
+    {
+        workers[w].batchInfo = batchInfo;
+        workers[w].id = w;
+        started[w] = pthread_create(&tids[w], NULL, batch_worker, &workers[w]) == 0;
+    }
+    // Worker 0 runs here; a worker that failed to start has its jobs stolen
+    workers[0].batchInfo = batchInfo;
+    workers[0].id = 0;
+    batch_worker(&workers[0]);
+
+    for (int w = 1; w < nworkers; w++)
+        if (started[w])
+            pthread_join(tids[w], NULL);
+
+    // Outputs still waiting for a group sync
+    Status group_status = flush_output_group();
+    if (group_status == failure)
+        fprintf(batchInfo->fptr_report, RED"[FAILED]"RESET" group sync of the last outputs\n");
+    batchInfo->seconds = get_seconds() - start;
+
+    double seconds = batchInfo->seconds > 0 ? batchInfo->seconds : 1e-9;
+    fprintf(batchInfo->fptr_report, BOLD"Jobs: %d, ok: %d, failed: %d, workers: %d\n"RESET,
+            batchInfo->count, batchInfo->ok, batchInfo->failed, nworkers);
+    fprintf(batchInfo->fptr_report, BOLD"Time: %.3f s, %.1f jobs/s, %.1f MB/s\n"RESET,
+            batchInfo->seconds, batchInfo->count / seconds, batchInfo->bytes / seconds / 1e6);
+
+    return batchInfo->failed == 0 && group_status == success ? success : failure;
+}
+
+/* Release the jobs */
+void free_batch(BatchInfo *batchInfo)
+{
+    for (int i = 0; i < batchInfo->count; i++)
+        for (int a = 2; a < 6; a++)
+            free(batchInfo->jobs[i].argv[a]);
+    free(batchInfo->jobs);
+
+    if (batchInfo->queues != NULL)
+    {
+        for (int w = 0; w < batchInfo->nworkers; w++)
+        {
+            free(batchInfo->queues[w].jobs);
+            pthread_mutex_destroy(&batchInfo->queues[w].lock);
+        }
+        free(batchInfo->queues);
+        pthread_mutex_destroy(&batchInfo->lock);
+    }
+    batchInfo->jobs = NULL;
+    batchInfo->queues = NULL;
+    batchInfo->count = 0;
+}
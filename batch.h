@@ -0,0 +1,69 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * One line of the manifest:
+ *   e <cover.bmp> <secret> [output.bmp]
+ *   d <stego.bmp> [output]
+ * Blank lines and lines starting with '#' are skipped.
+ */
+typedef struct _BatchJob
+{
+    int line;                // Line number in the manifest
+    OperationType op;        // encode or decode
+    char *argv[6];           // Arguments as main() would see them
+    Status status;           // Result of the job
+    double seconds;          // Time taken
+    unsigned long long bytes; // Size of the input image
+    char result_fname[100];  // File the job wrote (decoding adds the extension)
+} BatchJob;
+
+/* Per worker deque of job indices; the owner takes from the head, others steal from the tail */
+typedef struct _WorkQueue
+{
+    pthread_mutex_t lock;
+    int *jobs;
+    int head;
+    int tail;
+} WorkQueue;
+
+/*
+ * Structure to store information required for
+ * running a manifest of jobs
+ */
+typedef struct _BatchInfo
+{
+    char *manifest_fname; // To store the manifest name
+    BatchJob *jobs;       // Parsed jobs
+    int count;            // Number of jobs
+    WorkQueue *queues;    // One per worker
+    int nworkers;         // Number of workers
+    FILE *fptr_report;    // Where the report goes (the real stdout)
+
+    /* Totals */
+    int ok;
+    int failed;
+    unsigned long long bytes;
+    double seconds;
+    pthread_mutex_t lock; // Guards the totals and the report
+} BatchInfo;
+
+/* Batch function prototypes */
+
+/* Read and parse the manifest */
+Status read_batch_manifest(BatchInfo *batchInfo);
+
+/* Run every job on the work-stealing pool and print the report */
+Status do_batch(BatchInfo *batchInfo);
+
+/* Run one job with the given per-thread I/O buffer */
+Status run_batch_job(BatchJob *job, char *io_buffer);
+
+/* Release the jobs */
+void free_batch(BatchInfo *batchInfo);
+
+#endif
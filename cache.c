@@ -0,0 +1,389 @@
+#define _GNU_SOURCE // fopencookie()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "output.h"
+#include "stream.h"
+#include "colour.h"
+
+/* Image bytes packed per read while building a sidecar */
+#define CACHE_CHUNK (64 * 1024)
+
+static int cache_enabled = 0;
+
+/* Function Definitions */
+
+/* Use (and create) sidecars when opening stego images */
+void set_image_cache(int enabled)
+{
+    cache_enabled = enabled;
+}
+
+#ifdef __linux__
+
+/* State behind the FILE that reads a sidecar as if it were the image */
+struct _CacheReader
+{
+    void *map;                     // Whole sidecar, mapped read-only
+    size_t map_size;
+    const unsigned char *plane;    // Packed LSBs of the pixel bytes
+    char header[BMP_HEADER_SIZE];  // BMP header of the image
+    unsigned long long image_size; // Size of the image the stream stands for
+    unsigned long long pos;        // Position in that image
+};
+
+// 64 bit FNV-1a, continuing from hash
+static unsigned long long fnv1a(unsigned long long hash, const unsigned char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Key of the image as it is on disk now: size, inode, mtime, ctime and a hash of both ends
+static Status get_cache_key(const char *fname, CacheKey *key)
+{
+    int fd = open(fname, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < BMP_HEADER_SIZE)
+    {
+        if (fd >= 0)
+            close(fd);
+        return failure;
+    }
+
+    memset(key, 0, sizeof(*key)); // Padding is compared too
+    memcpy(key->magic, CACHE_MAGIC, sizeof(key->magic));
+    key->version = CACHE_VERSION;
+    key->image_size = st.st_size;
+    key->mtime_sec = st.st_mtim.tv_sec;
+    key->mtime_nsec = st.st_mtim.tv_nsec;
+    key->inode = st.st_ino;
+    key->ctime_sec = st.st_ctim.tv_sec;
+    key->ctime_nsec = st.st_ctim.tv_nsec;
+
+    unsigned char sample[CACHE_SAMPLE_SIZE];
+    unsigned long long hash = 14695981039346656037ULL;
+    ssize_t n = pread(fd, sample, sizeof(sample), 0);
+    if (n > 0)
+        hash = fnv1a(hash, sample, n);
+    if (n >= 0 && st.st_size > CACHE_SAMPLE_SIZE)
+    {
+        n = pread(fd, sample, sizeof(sample), st.st_size - CACHE_SAMPLE_SIZE);
+        if (n > 0)
+            hash = fnv1a(hash, sample, n);
+    }
+    close(fd);
+    if (n < 0)
+        return failure;
+
+    key->sample_hash = hash;
+    return success;
+}
+
+/* Write the sidecar
+ * Description: One pass over the image, 8 pixel bytes per plane byte.
+ * The sidecar is written to a temporary file and renamed into place at
+ * once (never held back for a group sync), and dropped if the image
+ * changed while it was read.
+ */
+static Status build_cache(const char *fname, const char *cache_fname, const CacheKey *key)
+{
+    FILE *fptr_image = fopen(fname, "r");
+    if (fptr_image == NULL)
+        return failure;
+
+    char header[BMP_HEADER_SIZE];
+    OutputFile out = {0};
+    FILE *fptr_cache = NULL;
+    Status status = read_bmp_header(fptr_image, header);
+    if (status == success)
+    {
+        fptr_cache = open_sidecar_output(&out, cache_fname);
+        if (fptr_cache == NULL ||
+            fwrite(key, sizeof(*key), 1, fptr_cache) != 1 ||
+            fwrite(header, 1, BMP_HEADER_SIZE, fptr_cache) != BMP_HEADER_SIZE)
+            status = failure;
+    }
+
+    unsigned char pixels[CACHE_CHUNK];
+    unsigned char plane[CACHE_CHUNK / 8];
+    size_t n;
+    while (status == success && (n = fread(pixels, 1, sizeof(pixels), fptr_image)) > 0)
+    {
+        // A short last group is padded with zero bits
+        if (n % 8 != 0)
+            memset(pixels + n, 0, 8 - n % 8);
+        size_t groups = (n + 7) / 8;
+        for (size_t g = 0; g < groups; g++)
+        {
+            unsigned char byte = 0;
+            for (int k = 0; k < 8; k++)
+                byte = (byte << 1) | (pixels[g * 8 + k] & 1);
+            plane[g] = byte;
+        }
+        if (fwrite(plane, 1, groups, fptr_cache) != groups)
+            status = failure;
+    }
+    if (ferror(fptr_image))
+        status = failure;
+    fclose(fptr_image);
+
+    CacheKey now;
+    if (status == success && (get_cache_key(fname, &now) == failure || memcmp(&now, key, sizeof(now)) != 0))
+        status = failure;
+
+    if (status == success)
+        status = commit_output(&out);
+    else
+        abort_output(&out);
+    return status;
+}
+
+// 8 plane bits (MSB first) as 8 bytes of 0 or 1, in memory order
+static inline void expand_byte(unsigned char byte, unsigned char *out)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // Copy the byte to every lane, keep bit 7 - k in lane k, then turn each lane into 0 or 1
+    unsigned long long lanes = (byte * 0x0101010101010101ULL) & 0x0102040810204080ULL;
+    lanes = ((lanes + 0x7F7F7F7F7F7F7F7FULL) >> 7) & 0x0101010101010101ULL;
+    memcpy(out, &lanes, 8);
+#else
+    for (int k = 0; k < 8; k++)
+        out[k] = (byte >> (7 - k)) & 1;
+#endif
+}
+
+// Expand len plane bits from bit on back to one byte (0 or 1) each
+static void expand_bits(const unsigned char *plane, unsigned long long bit, unsigned char *buf, size_t len)
+{
+    size_t n = 0;
+
+    // Up to the next plane byte, then whole plane bytes, then the rest
+    for (; n < len && (bit & 7) != 0; n++, bit++)
+        buf[n] = (plane[bit >> 3] >> (7 - (bit & 7))) & 1;
+    for (; len - n >= 8; n += 8, bit += 8)
+        expand_byte(plane[bit >> 3], buf + n);
+    for (; n < len; n++, bit++)
+        buf[n] = (plane[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+// The image as the stream sees it: the header, then one byte (0 or 1) per pixel byte
+static ssize_t cache_read(void *cookie, char *buf, size_t size)
+{
+    CacheReader *cr = cookie;
+    size_t n = 0;
+
+    while (n < size && cr->pos < BMP_HEADER_SIZE)
+        buf[n++] = cr->header[cr->pos++];
+
+    if (cr->pos >= cr->image_size)
+        return n;
+    size_t left = size - n;
+    if (cr->image_size - cr->pos < left)
+        left = cr->image_size - cr->pos;
+    expand_bits(cr->plane, cr->pos - BMP_HEADER_SIZE, (unsigned char *)buf + n, left);
+    cr->pos += left;
+    return n + left;
+}
+
+static int cache_seek(void *cookie, off64_t *offset, int whence)
+{
+    CacheReader *cr = cookie;
+    long long base;
+    if (whence == SEEK_SET)
+        base = 0;
+    else if (whence == SEEK_CUR)
+        base = cr->pos;
+    else if (whence == SEEK_END)
+        base = cr->image_size;
+    else
+        return -1;
+
+    if (base + *offset < 0)
+        return -1;
+    cr->pos = base + *offset;
+    *offset = cr->pos;
+    return 0;
+}
+
+static int cache_close(void *cookie)
+{
+    CacheReader *cr = cookie;
+    munmap(cr->map, cr->map_size);
+    free(cr);
+    return 0;
+}
+
+// Map a sidecar; NULL unless it belongs to the image as it is now
+static FILE *map_cache(const char *cache_fname, const CacheKey *key, CacheReader **cache)
+{
+    int fd = open(cache_fname, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    unsigned long long plane_size = (key->image_size - BMP_HEADER_SIZE + 7) / 8;
+    if (fstat(fd, &st) != 0 || (unsigned long long)st.st_size != sizeof(CacheKey) + BMP_HEADER_SIZE + plane_size)
+    {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    if (memcmp(map, key, sizeof(CacheKey)) != 0)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    CacheReader *cr = malloc(sizeof(CacheReader));
+    if (cr == NULL)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    cr->map = map;
+    cr->map_size = st.st_size;
+    memcpy(cr->header, (char *)map + sizeof(CacheKey), BMP_HEADER_SIZE);
+    cr->plane = (const unsigned char *)map + sizeof(CacheKey) + BMP_HEADER_SIZE;
+    cr->image_size = key->image_size;
+    cr->pos = 0;
+
+    cookie_io_functions_t io = {cache_read, NULL, cache_seek, cache_close};
+    FILE *fptr = fopencookie(cr, "r", io);
+    if (fptr == NULL)
+    {
+        cache_close(cr);
+        return NULL;
+    }
+    // Nothing read ahead: the bulk of the reads bypass the stream (read_cached_payload())
+    setvbuf(fptr, NULL, _IONBF, 0);
+    *cache = cr;
+    return fptr;
+}
+
+// Sidecar stream for the image, building the sidecar if missing or stale
+static FILE *open_cached_image(const char *fname, CacheReader **cache)
+{
+    CacheKey key;
+    if (get_cache_key(fname, &key) == failure)
+        return NULL;
+
+    size_t len = strlen(fname) + sizeof(CACHE_SUFFIX);
+    char *cache_fname = malloc(len);
+    if (cache_fname == NULL)
+        return NULL;
+    snprintf(cache_fname, len, "%s%s", fname, CACHE_SUFFIX);
+
+    FILE *fptr = map_cache(cache_fname, &key, cache);
+    if (fptr != NULL)
+        printf(MAGENTA"INFO: Reading LSB cache "RESET BOLD"%s\n"RESET, cache_fname);
+    else
+    {
+        printf(YELLOW"INFO: Building LSB cache %s\n"RESET, cache_fname);
+        if (build_cache(fname, cache_fname, &key) == success)
+            fptr = map_cache(cache_fname, &key, cache);
+        if (fptr == NULL)
+            fprintf(stderr, YELLOW"WARNING: Unable to use LSB cache %s, reading the image\n"RESET, cache_fname);
+    }
+    free(cache_fname);
+    return fptr;
+}
+
+// Bit of the plane at the stream's position, once len image bytes from there are known to exist
+static Status get_cached_bit(CacheReader *cache, FILE *fptr, unsigned long long len, unsigned long long *bit)
+{
+    long pos = ftell(fptr);
+    if (pos < BMP_HEADER_SIZE || (unsigned long long)pos + len > cache->image_size)
+        return failure;
+    *bit = pos - BMP_HEADER_SIZE;
+    return success;
+}
+
+/* Decode len payload bytes from the next len * 8 image bytes of fptr
+ * Description: The plane holds the LSBs in payload order, so at a byte
+ * boundary (every field and archive entry starts on one) plane byte i
+ * is payload byte i and the whole run is one memcpy(); otherwise each
+ * byte is put together from two plane bytes.
+ */
+Status read_cached_payload(CacheReader *cache, FILE *fptr, char *data, uint len)
+{
+    unsigned long long bit;
+    if (get_cached_bit(cache, fptr, (unsigned long long)len * 8, &bit) == failure)
+        return failure;
+
+    const unsigned char *p = cache->plane + (bit >> 3);
+    uint shift = bit & 7;
+    if (shift == 0)
+        memcpy(data, p, len);
+    else
+        for (uint i = 0; i < len; i++)
+            data[i] = (char)(p[i] << shift | p[i + 1] >> (8 - shift));
+
+    return fseek(fptr, BMP_HEADER_SIZE + bit + (unsigned long long)len * 8, SEEK_SET) == 0 ? success : failure;
+}
+
+/* Read the next len image bytes of fptr as their LSBs (0 or 1) */
+Status read_cached_lsbs(CacheReader *cache, FILE *fptr, unsigned char *buf, uint len)
+{
+    unsigned long long bit;
+    if (get_cached_bit(cache, fptr, len, &bit) == failure)
+        return failure;
+
+    expand_bits(cache->plane, bit, buf, len);
+    return fseek(fptr, BMP_HEADER_SIZE + bit + len, SEEK_SET) == 0 ? success : failure;
+}
+
+#else
+
+static FILE *open_cached_image(const char *fname, CacheReader **cache)
+{
+    (void)fname;
+    (void)cache;
+    return NULL;
+}
+
+/* Sidecars are never opened here, so there is nothing to read */
+Status read_cached_payload(CacheReader *cache, FILE *fptr, char *data, uint len)
+{
+    (void)cache;
+    (void)fptr;
+    (void)data;
+    (void)len;
+    return failure;
+}
+
+Status read_cached_lsbs(CacheReader *cache, FILE *fptr, unsigned char *buf, uint len)
+{
+    (void)cache;
+    (void)fptr;
+    (void)buf;
+    (void)len;
+    return failure;
+}
+
+#endif
+
+/* Open a stego image for reading, from its sidecar when caching is on */
+FILE *open_stego_image(const char *fname, CacheReader **cache)
+{
+    *cache = NULL;
+    if (cache_enabled)
+    {
+        FILE *fptr = open_cached_image(fname, cache);
+        if (fptr != NULL)
+            return fptr;
+    }
+    return fopen(fname, "r");
+}
@@ -0,0 +1,56 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include "types.h"  // Contains user defined types
+#include "common.h" // Contains BMP_HEADER_SIZE
+
+/* Sidecar name is the image name plus this suffix */
+#define CACHE_SUFFIX ".lsbc"
+#define CACHE_MAGIC "LSBC"
+#define CACHE_VERSION 2
+
+/* Bytes hashed at each end of the image, a cheap extra check on top of the times */
+#define CACHE_SAMPLE_SIZE 4096
+
+/*
+ * Sidecar layout: CacheKey, the 54 byte BMP header, then the LSB of
+ * every pixel byte packed 8 to a byte, MSB first (the same order the
+ * payload is hidden in, so plane byte i is payload byte i)
+ */
+typedef struct _CacheKey
+{
+    char magic[4];                  // CACHE_MAGIC
+    uint version;                   // CACHE_VERSION
+    unsigned long long image_size;  // Size of the image file
+    long long mtime_sec;            // Modification time of the image
+    long long mtime_nsec;
+    unsigned long long inode;       // A replaced image is a new inode
+    long long ctime_sec;            // Change time, which utimensat() can't set back
+    long long ctime_nsec;
+    unsigned long long sample_hash; // FNV-1a of the first and last CACHE_SAMPLE_SIZE bytes
+} CacheKey;
+
+/* A sidecar opened in place of a stego image (see open_stego_image()) */
+typedef struct _CacheReader CacheReader;
+
+/* Cache function prototypes */
+
+/* Use (and create) sidecars when opening stego images */
+void set_image_cache(int enabled);
+
+/* Open a stego image for reading, from its sidecar when caching is on
+ * *cache is set when the stream reads the sidecar: pixel bytes then
+ * read back as 0 or 1 (their LSB only), and the read_cached_*()
+ * functions below take them straight from the packed plane. It is
+ * freed with the stream.
+ */
+FILE *open_stego_image(const char *fname, CacheReader **cache);
+
+/* Decode len payload bytes from the next len * 8 image bytes of fptr */
+Status read_cached_payload(CacheReader *cache, FILE *fptr, char *data, uint len);
+
+/* Read the next len image bytes of fptr as their LSBs (0 or 1) */
+Status read_cached_lsbs(CacheReader *cache, FILE *fptr, unsigned char *buf, uint len);
+
+#endif
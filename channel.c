@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "channel.h"
+#include "encode.h"
+#include "colour.h"
+
+/* Function Definitions */
+
+/* Parse a mask such as "b", "bg" or "bgr" */
+Status parse_channel_mask(const char *arg, uint *mask)
+{
+    *mask = 0;
+    for (const char *p = arg; *p; p++)
+    {
+        switch (*p)
+        {
+            case 'b': case 'B': *mask |= CHANNEL_B; break;
+            case 'g': case 'G': *mask |= CHANNEL_G; break;
+            case 'r': case 'R': *mask |= CHANNEL_R; break;
+            case 'a': case 'A': *mask |= CHANNEL_A; break;
+            default:
+                printf(RED"ERROR: Invalid channel '%c', use b, g, r and a\n"RESET, *p);
+                return failure;
+        }
+    }
+
+    if (*mask == 0)
+    {
+        printf(RED"ERROR: Channel mask is empty\n"RESET);
+        return failure;
+    }
+    return success;
+}
+
+/* Build the gather/scatter table for a mask
+ * Description: The fixed fields take the first 48 pixel bytes, so the
+ * payload starts on the first full row after them.
+ */
+Status build_channel_map(ChannelMap *map, uint mask, const char *header)
+{
+    uint width, height, bpp;
+    get_bmp_dimensions(header, &width, &height, &bpp);
+
+    if (bpp != 24 && bpp != 32)
+    {
+        fprintf(stderr, RED"ERROR: Channel masks need a 24 or 32 bpp image (got %u)\n"RESET, bpp);
+        return failure;
+    }
+
+    uint channels = bpp / 8;
+    if (mask == 0 || (mask >> channels) != 0)
+    {
+        fprintf(stderr, RED"ERROR: Channel mask 0x%x is not valid for a %u bpp image\n"RESET, mask, bpp);
+        return failure;
+    }
+
+    map->mask = mask;
+    map->bytes_per_pixel = channels;
+    map->row_stride = get_row_stride(header);
+    map->first_row = (FIXED_FIELDS_SIZE + map->row_stride - 1) / map->row_stride;
+    map->rows = height > map->first_row ? height - map->first_row : 0;
+
+    uint per_pixel = 0;
+    for (uint c = 0; c < channels; c++)
+        per_pixel += (mask >> c) & 1;
+
+    map->width = width;
+    map->per_pixel = per_pixel;
+    map->complexity = NULL;
+    map->threshold = 0;
+    map->row_slots = width * per_pixel;
+    map->offsets = malloc((size_t)map->row_slots * sizeof(uint));
+    if (map->offsets == NULL)
+        return failure;
+
+    uint slot = 0;
+    for (uint x = 0; x < width; x++)
+        for (uint c = 0; c < channels; c++)
+            if (mask & (1u << c))
+                map->offsets[slot++] = x * channels + c;
+
+    // One channel, or all of them, gives evenly spaced slots the kernels can step through
+    if (per_pixel == 1)
+        map->stride = channels;
+    else if (per_pixel == channels)
+        map->stride = 1;
+    else
+        map->stride = 0;
+
+    return success;
+}
+
+/* Payload capacity of the map, in bytes */
+unsigned long long get_channel_capacity(const ChannelMap *map)
+{
+    if (map->complexity == NULL)
+        return (unsigned long long)map->rows * map->row_slots / 8;
+
+    // Adaptive: only the pixels at or above the threshold
+    unsigned long long pixels = 0;
+    for (uint v = map->threshold; v < 256; v++)
+        pixels += map->complexity_hist[v];
+    return pixels * map->per_pixel / 8;
+}
+
+/* Release the table */
+void free_channel_map(ChannelMap *map)
+{
+    free(map->offsets);
+    free(map->complexity);
+    map->offsets = NULL;
+    map->complexity = NULL;
+}
+
+/* Start a cursor right after the fixed fields
+ * Description: Bytes between the fixed fields and the first payload row
+ * are copied unchanged (encoding) or skipped (decoding).
+ */
+Status open_channel_cursor(ChannelCursor *cursor, const ChannelMap *map, FILE *fptr_src, FILE *fptr_dest)
+{
+    cursor->map = map;
+    cursor->fptr_src = fptr_src;
+    cursor->fptr_dest = fptr_dest;
+    cursor->slot = 0;
+    cursor->active_slots = 0;
+    cursor->rows_used = 0;
+    cursor->cache = NULL;
+    cursor->row = malloc(map->row_stride);
+    cursor->active = map->offsets;
+    cursor->stride = map->stride;
+    cursor->selected = NULL;
+    if (cursor->row == NULL)
+        return failure;
+    if (map->complexity != NULL)
+    {
+        cursor->selected = malloc((size_t)map->row_slots * sizeof(uint));
+        if (cursor->selected == NULL)
+            return failure;
+    }
+
+    uint gap = map->first_row * map->row_stride - FIXED_FIELDS_SIZE;
+    if (gap > 0)
+    {
+        if (fread(cursor->row, 1, gap, fptr_src) != gap)
+            return failure;
+        if (fptr_dest != NULL && fwrite(cursor->row, 1, gap, fptr_dest) != gap)
+            return failure;
+    }
+    return success;
+}
+
+// Offsets of the slots used in a row: all of them (the map's own table), or those of complex enough pixels
+static void select_row_slots(ChannelCursor *cursor, uint row)
+{
+    const ChannelMap *map = cursor->map;
+
+    if (map->complexity == NULL)
+    {
+        cursor->active_slots = map->row_slots;
+        return;
+    }
+
+    const unsigned char *complexity = map->complexity + (size_t)row * map->width;
+    uint n = 0;
+    for (uint x = 0; x < map->width; x++)
+    {
+        if (complexity[x] < map->threshold)
+            continue;
+        for (uint k = 0; k < map->per_pixel; k++)
+            cursor->selected[n++] = map->offsets[x * map->per_pixel + k];
+    }
+    cursor->active = cursor->selected;
+    cursor->active_slots = n;
+    cursor->stride = 0;
+}
+
+// Read the next row, only its LSBs when it comes from the LSB cache
+static Status read_row(ChannelCursor *cursor)
+{
+    uint size = cursor->map->row_stride;
+    if (cursor->cache != NULL)
+        return read_cached_lsbs(cursor->cache, cursor->fptr_src, cursor->row, size);
+    return fread(cursor->row, 1, size, cursor->fptr_src) == size ? success : failure;
+}
+
+// Write out the current row and read the next one that has slots
+static Status load_next_row(ChannelCursor *cursor)
+{
+    const ChannelMap *map = cursor->map;
+
+    do
+    {
+        if (cursor->rows_used > 0 && cursor->fptr_dest != NULL &&
+            fwrite(cursor->row, 1, map->row_stride, cursor->fptr_dest) != map->row_stride)
+            return failure;
+
+        if (cursor->rows_used == map->rows || read_row(cursor) == failure)
+        {
+            fprintf(stderr, RED"ERROR: Ran out of image rows for the channel mask\n"RESET);
+            return failure;
+        }
+
+        select_row_slots(cursor, map->first_row + cursor->rows_used);
+        cursor->rows_used++;
+    } while (cursor->active_slots == 0);
+
+    cursor->slot = 0;
+    return success;
+}
+
+/* LSBs of the 8 bytes step apart from p, MSB first */
+static inline unsigned char gather_step(const unsigned char *p, uint step)
+{
+    return (p[0] & 1) << 7 | (p[step] & 1) << 6 | (p[2 * step] & 1) << 5 | (p[3 * step] & 1) << 4 |
+           (p[4 * step] & 1) << 3 | (p[5 * step] & 1) << 2 | (p[6 * step] & 1) << 1 | (p[7 * step] & 1);
+}
+
+/* Hide byte in the LSBs of the 8 bytes step apart from p, MSB first */
+static inline void scatter_step(unsigned char *p, uint step, unsigned char byte)
+{
+    for (int k = 0; k < 8; k++)
+        p[k * step] = (p[k * step] & 0xFE) | ((byte >> (7 - k)) & 1);
+}
+
+/* Byte from the next 8 slots of the current row
+ * Description: The switch gives one loop per slot spacing (all channels,
+ * one channel of 24 or 32 bpp) with the step known at compile time;
+ * other masks and adaptive rows go through the offset table.
+ */
+static unsigned char gather_byte(const ChannelCursor *cursor)
+{
+    const unsigned char *row = cursor->row;
+    const uint *offsets = cursor->active + cursor->slot;
+
+    switch (cursor->stride)
+    {
+        case 1:
+            return gather_step(row + offsets[0], 1);
+        case 3:
+            return gather_step(row + offsets[0], 3);
+        case 4:
+            return gather_step(row + offsets[0], 4);
+        default:
+        {
+            unsigned char byte = 0;
+            for (int k = 0; k < 8; k++)
+                byte = (byte << 1) | (row[offsets[k]] & 1);
+            return byte;
+        }
+    }
+}
+
+/* Hide a byte in the next 8 slots of the current row, like gather_byte() */
+static void scatter_byte(ChannelCursor *cursor, unsigned char byte)
+{
+    unsigned char *row = cursor->row;
+    const uint *offsets = cursor->active + cursor->slot;
+
+    switch (cursor->stride)
+    {
+        case 1:
+            scatter_step(row + offsets[0], 1, byte);
+            break;
+        case 3:
+            scatter_step(row + offsets[0], 3, byte);
+            break;
+        case 4:
+            scatter_step(row + offsets[0], 4, byte);
+            break;
+        default:
+            for (int k = 0; k < 8; k++)
+                row[offsets[k]] = (row[offsets[k]] & 0xFE) | ((byte >> (7 - k)) & 1);
+            break;
+    }
+}
+
+/* Hide len bytes in the selected bytes, MSB first */
+Status channel_encode_bytes(ChannelCursor *cursor, const char *data, uint len)
+{
+    for (uint i = 0; i < len; i++)
+    {
+        // Whole byte in the current row
+        if (cursor->active_slots - cursor->slot >= 8)
+        {
+            scatter_byte(cursor, (unsigned char)data[i]);
+            cursor->slot += 8;
+            continue;
+        }
+
+        // Byte split across rows, one bit at a time
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            if (cursor->slot == cursor->active_slots && load_next_row(cursor) == failure)
+                return failure;
+            unsigned char *p = cursor->row + cursor->active[cursor->slot++];
+            *p = (*p & 0xFE) | ((data[i] >> bit) & 1);
+        }
+    }
+    return success;
+}
+
+/* Get len bytes back from the selected bytes */
+Status channel_decode_bytes(ChannelCursor *cursor, char *data, uint len)
+{
+    for (uint i = 0; i < len; i++)
+    {
+        // Whole byte in the current row
+        if (cursor->active_slots - cursor->slot >= 8)
+        {
+            data[i] = (char)gather_byte(cursor);
+            cursor->slot += 8;
+            continue;
+        }
+
+        // Byte split across rows, one bit at a time
+        unsigned char byte = 0;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            if (cursor->slot == cursor->active_slots && load_next_row(cursor) == failure)
+                return failure;
+            byte = (byte << 1) | (cursor->row[cursor->active[cursor->slot++]] & 1);
+        }
+        data[i] = (char)byte;
+    }
+    return success;
+}
+
+/* Write out the current row (encoding) and release the cursor */
+Status close_channel_cursor(ChannelCursor *cursor)
+{
+    Status status = success;
+    if (cursor->fptr_dest != NULL && cursor->rows_used > 0 &&
+        fwrite(cursor->row, 1, cursor->map->row_stride, cursor->fptr_dest) != cursor->map->row_stride)
+        status = failure;
+
+    free(cursor->row);
+    free(cursor->selected);
+    cursor->row = NULL;
+    cursor->selected = NULL;
+    cursor->active = NULL;
+    return status;
+}
@@ -0,0 +1,87 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <stdio.h>
+#include "types.h" // Contains user defined types
+#include "cache.h" // Contains CacheReader
+
+/* Channel mask bits, in the byte order of a BMP pixel */
+#define CHANNEL_B 0x01
+#define CHANNEL_G 0x02
+#define CHANNEL_R 0x04
+#define CHANNEL_A 0x08 // Only in 32 bpp images
+
+/* Image bytes used by the magic string and extn size word, which always use every byte */
+#define FIXED_FIELDS_SIZE 48
+
+/*
+ * Precomputed row layout for a channel mask. offsets[] lists, for one
+ * row, the byte offset of every selected byte (slot) in order, so the
+ * kernels gather/scatter through the table instead of testing each
+ * byte against the mask.
+ */
+typedef struct _ChannelMap
+{
+    uint mask;            // CHANNEL_* bits
+    uint bytes_per_pixel; // 3 or 4
+    uint row_stride;      // Bytes per row including padding
+    uint first_row;       // First row after the fixed fields
+    uint rows;            // Rows available for the payload
+    uint row_slots;       // Selected bytes per row
+    uint *offsets;        // Byte offset of each slot within a row
+    uint stride;          // Distance between slots when it is constant (1, 3 or 4), else 0
+
+    /* Adaptive mode: only pixels at least as complex as the threshold are used */
+    uint width;                          // Width in pixels
+    uint per_pixel;                      // Selected bytes per pixel
+    unsigned char *complexity;           // Per pixel complexity, NULL when not adaptive
+    uint threshold;                      // Minimum complexity of a used pixel
+    unsigned long long complexity_hist[256]; // Pixels of the payload rows per complexity
+} ChannelMap;
+
+/*
+ * Forward-only cursor over the selected bytes. When encoding, every
+ * row read from fptr_src is written to fptr_dest once it is used up.
+ */
+typedef struct _ChannelCursor
+{
+    const ChannelMap *map;
+    FILE *fptr_src;     // Image to read rows from
+    FILE *fptr_dest;    // Image to write rows to (NULL when decoding)
+    unsigned char *row; // Current row
+    const uint *active; // Offsets of the slots used in the current row
+    uint *selected;     // Adaptive: slots of the complex enough pixels (active points here)
+    uint active_slots;  // Number of slots used in the current row
+    uint stride;        // Constant distance between the active slots, 0 to go through active[]
+    uint slot;          // Next slot in the current row
+    uint rows_used;     // Rows read so far
+    CacheReader *cache; // Decoding from the LSB cache: rows come from its plane (set after opening)
+} ChannelCursor;
+
+/* Channel function prototypes */
+
+/* Parse a mask such as "b", "bg" or "bgr" */
+Status parse_channel_mask(const char *arg, uint *mask);
+
+/* Build the gather/scatter table for a mask */
+Status build_channel_map(ChannelMap *map, uint mask, const char *header);
+
+/* Payload capacity of the map, in bytes */
+unsigned long long get_channel_capacity(const ChannelMap *map);
+
+/* Release the table */
+void free_channel_map(ChannelMap *map);
+
+/* Start a cursor right after the fixed fields */
+Status open_channel_cursor(ChannelCursor *cursor, const ChannelMap *map, FILE *fptr_src, FILE *fptr_dest);
+
+/* Hide len bytes in the selected bytes */
+Status channel_encode_bytes(ChannelCursor *cursor, const char *data, uint len);
+
+/* Get len bytes back from the selected bytes */
+Status channel_decode_bytes(ChannelCursor *cursor, char *data, uint len);
+
+/* Write out the current row (encoding) and release the cursor */
+Status close_channel_cursor(ChannelCursor *cursor);
+
+#endif
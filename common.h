@@ -5,7 +5,29 @@
 /* Magic string to identify whether stegged or not */
 #define MAGIC_STRING "#*"
 
+/* Magic string for images holding several files with a directory table */
+#define ARCHIVE_MAGIC "#&"
+
 /* Maximum size for file extension */
 #define MAX_FILE_SUFFIX 8
 
+/* The 4 byte extn size field also carries the channel mask:
+ * bits 0-7 extension size, bits 8-15 channel mask (0 = every byte),
+ * bits 16-23 adaptive complexity threshold (0 = not adaptive) */
+#define EXTN_SIZE_BITS 0xFF
+#define CHANNEL_MASK_SHIFT 8
+#define ADAPTIVE_SHIFT 16
+
+/* Size of the BMP file header + info header */
+#define BMP_HEADER_SIZE 54
+
+/* Largest pixel array a BMP can hold (its file size field is 32 bits) */
+#define BMP_MAX_PIXEL_BYTES (0xFFFFFFFFULL - BMP_HEADER_SIZE)
+
+/* Size of each caller-provided stdio buffer (batch mode reuses them per thread) */
+#define IO_BUFFER_SIZE (64 * 1024)
+
+/* File name used for stdin/stdout in streaming mode */
+#define STREAM_FNAME "-"
+
 #endif // COMMON_H
\ No newline at end of file
@@ -1,6 +1,11 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "decode.h"
+#include "encode.h"
+#include "stream.h"
+#include "adaptive.h"
+#include "cache.h"
 #include "types.h"
 #include "common.h"
 #include "colour.h"
@@ -10,18 +15,21 @@
 /* Read and validate decode arguments */
 Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
 {
-    // Validate stego image filename
-    if (strlen(argv[2]) < 4)
+    // Validate stego image filename ("-" reads the stego image from stdin)
+    if (!is_stream_fname(argv[2]))
     {
-        printf(RED"ERROR: Invalid source file name length.\n"RESET);
-        return failure;
-    }
+        if (strlen(argv[2]) < 4)
+        {
+            printf(RED"ERROR: Invalid source file name length.\n"RESET);
+            return failure;
+        }
 
-    char *src_ext = argv[2] + strlen(argv[2]) - 4;
-    if (strcmp(src_ext, ".bmp") != 0)
-    {
-        printf(RED"ERROR: Invalid source file. Use .bmp files.\n"RESET);
-        return failure;
+        char *src_ext = argv[2] + strlen(argv[2]) - 4;
+        if (strcmp(src_ext, ".bmp") != 0)
+        {
+            printf(RED"ERROR: Invalid source file. Use .bmp files.\n"RESET);
+            return failure;
+        }
     }
 
     decInfo->src_image_fname = argv[2];
@@ -29,6 +37,12 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
     // Handle optional output argument
     if (argv[3] != NULL)
     {
+        // Leave room for the decoded extension to be added
+        if (strlen(argv[3]) >= sizeof(decInfo->secret_fname))
+        {
+            printf(RED"ERROR: Output file name is too long (max %zu characters).\n"RESET, sizeof(decInfo->secret_fname) - 1);
+            return failure;
+        }
         strcpy(decInfo->secret_fname, argv[3]);
         decInfo->fptr_secret = NULL;
     }
@@ -41,10 +55,18 @@ Status read_and_validate_decode_args(char *argv[], DecodeInfo *decInfo)
     return success;
 }
 
-/* Open required files */
+/* Open required files
+ * Description: A stream the caller opened already (e.g. an in-memory
+ * image) is used as it is.
+ */
 Status open_files_decode(DecodeInfo *decInfo)
 {
-    decInfo->fptr_src_image = fopen(decInfo->src_image_fname, "r");
+    if (decInfo->fptr_src_image != NULL)
+        ; // Opened by the caller
+    else if (is_stream_fname(decInfo->src_image_fname))
+        decInfo->fptr_src_image = stdin;
+    else
+        decInfo->fptr_src_image = open_stego_image(decInfo->src_image_fname, &decInfo->src_cache);
 
     printf(YELLOW"INFO: Opening source image file\n"RESET);
     if (decInfo->fptr_src_image == NULL)
@@ -53,10 +75,32 @@ Status open_files_decode(DecodeInfo *decInfo)
         fprintf(stderr, RED"ERROR: Unable to open source image file %s\n"RESET, decInfo->src_image_fname);
         return failure;
     }
+    if (decInfo->io_buffer != NULL && decInfo->fptr_src_image != stdin && decInfo->src_cache == NULL)
+        setvbuf(decInfo->fptr_src_image, decInfo->io_buffer, _IOFBF, IO_BUFFER_SIZE);
     printf(GREEN"SUCCESS: Opened source image file\n"RESET);
     return success;
 }
 
+/* Close whatever files are still open and release buffers
+ * Description: Safe to call after a failure at any step, and more than once.
+ */
+void close_decode_files(DecodeInfo *decInfo)
+{
+    // A secret file that was not committed is removed
+    abort_output(&decInfo->secret_output);
+    if (decInfo->fptr_src_image != NULL && decInfo->fptr_src_image != stdin)
+        fclose(decInfo->fptr_src_image);
+    decInfo->fptr_secret = NULL;
+    decInfo->fptr_src_image = NULL;
+    decInfo->src_cache = NULL; // Freed with the stream
+
+    free(decInfo->cursor.row);
+    free(decInfo->cursor.selected);
+    decInfo->cursor.row = NULL;
+    decInfo->cursor.selected = NULL;
+    free_channel_map(&decInfo->channel_map);
+}
+
 /* Decode 1 byte from 8 LSBs */
 Status decode_byte_from_lsb(char *image_buffer, char *data)
 {
@@ -74,6 +118,10 @@ Status decode_byte_from_lsb(char *image_buffer, char *data)
 /* Decode N bytes of data from image */
 Status decode_data_from_image(int size, FILE *fptr_src_image, char *data, DecodeInfo *decInfo)
 {
+    // The LSB cache holds the payload bytes as they are
+    if (decInfo->src_cache != NULL)
+        return read_cached_payload(decInfo->src_cache, fptr_src_image, data, size);
+
     for (int i = 0; i < size; i++)
     {
         // Use a temporary buffer on the stack to read the 8 image bytes
@@ -109,15 +157,20 @@ Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo)
     char decoded_ms[len + 1];
     decoded_ms[len] = '\0';
 
-    fseek(decInfo->fptr_src_image, 54, SEEK_SET); // Skip BMP header
+    // Skip BMP header by reading it, so stdin works as well
+    if (read_bmp_header(decInfo->fptr_src_image, decInfo->bmp_header) == failure)
+        return failure;
 
     if (decode_data_from_image(len, decInfo->fptr_src_image, decoded_ms, decInfo) == failure)
         return failure;
 
     if (strcmp(decoded_ms, magic_string) == 0)
         return success;
-    else
-        return failure;
+
+    // Image holds several files, they are read with --list / --extract
+    if (strcmp(decoded_ms, ARCHIVE_MAGIC) == 0)
+        fprintf(stderr, YELLOW"INFO: Image holds several files, use --list or --extract\n"RESET);
+    return failure;
 }
 
 /* Decode secret file extn size */
@@ -131,14 +184,62 @@ Status decode_secret_file_extn_size(DecodeInfo *decInfo)
     if (decode_size_from_lsb(decInfo->image_data, &extn_size) == failure)
         return failure;
 
+    // Upper bits carry the channel mask and adaptive threshold, nothing else may be set
+    long mask = (extn_size >> CHANNEL_MASK_SHIFT) & 0xFF;
+    long threshold = (extn_size >> ADAPTIVE_SHIFT);
+    extn_size &= EXTN_SIZE_BITS;
+
     // The maximum size for extn_secret_file is 5, including the null terminator.
-    if (extn_size <= 0 || extn_size > 4) 
+    if (extn_size <= 0 || extn_size > 4 || threshold > 0xFF || (threshold != 0 && mask == 0)) 
     {
         fprintf(stderr, RED"ERROR: Decoded extn size invalid: %ld\n"RESET, extn_size);
         return failure;
     }
 
     decInfo->extn_size = (int)extn_size; // Store the size for later use
+    decInfo->channel_mask = (uint)mask;
+
+    // The rest is read only from the bytes selected by the channel mask
+    if (decInfo->channel_mask != 0)
+    {
+        printf(MAGENTA"INFO: Channel mask: "RESET BOLD"0x%x\n"RESET, decInfo->channel_mask);
+        if (check_pixel_array_size(decInfo->fptr_src_image, decInfo->bmp_header) == failure ||
+            build_channel_map(&decInfo->channel_map, decInfo->channel_mask, decInfo->bmp_header) == failure)
+            return failure;
+
+        // Adaptive: rebuild the complexity map from the higher bit planes
+        if (threshold != 0)
+        {
+            printf(MAGENTA"INFO: Adaptive threshold: "RESET BOLD"%ld\n"RESET, threshold);
+
+            // The complexity map needs the full pixel values, which the LSB cache does not hold
+            if (decInfo->src_cache != NULL)
+            {
+                printf(YELLOW"INFO: Adaptive image, reading the pixels from the image itself\n"RESET);
+                fclose(decInfo->fptr_src_image);
+                decInfo->src_cache = NULL;
+                decInfo->fptr_src_image = fopen(decInfo->src_image_fname, "r");
+                if (decInfo->fptr_src_image == NULL)
+                {
+                    perror(RED"ERROR: Unable to open source image file"RESET);
+                    return failure;
+                }
+            }
+            if (fseek(decInfo->fptr_src_image, BMP_HEADER_SIZE, SEEK_SET) != 0)
+            {
+                fprintf(stderr, RED"ERROR: Adaptive images can't be decoded from a pipe\n"RESET);
+                return failure;
+            }
+            if (build_complexity_map(&decInfo->channel_map, decInfo->fptr_src_image) == failure ||
+                fseek(decInfo->fptr_src_image, BMP_HEADER_SIZE + FIXED_FIELDS_SIZE, SEEK_SET) != 0)
+                return failure;
+            decInfo->channel_map.threshold = (uint)threshold;
+        }
+
+        if (open_channel_cursor(&decInfo->cursor, &decInfo->channel_map, decInfo->fptr_src_image, NULL) == failure)
+            return failure;
+        decInfo->cursor.cache = decInfo->src_cache;
+    }
     return success;
 }
 
@@ -146,11 +247,35 @@ Status decode_secret_file_extn_size(DecodeInfo *decInfo)
 Status decode_secret_file_extn(DecodeInfo *decInfo)
 {
     // Decode 'extn_size' bytes for the extension
-    if (decode_data_from_image(decInfo->extn_size, decInfo->fptr_src_image, decInfo->extn_secret_file, decInfo) == failure)
+    if (decInfo->channel_mask != 0)
+    {
+        if (channel_decode_bytes(&decInfo->cursor, decInfo->extn_secret_file, decInfo->extn_size) == failure)
+            return failure;
+    }
+    else if (decode_data_from_image(decInfo->extn_size, decInfo->fptr_src_image, decInfo->extn_secret_file, decInfo) == failure)
         return failure;
 
     decInfo->extn_secret_file[decInfo->extn_size] = '\0'; // Null-terminate
 
+    // The extension is appended to the output name, so it must not hold a path
+    if (decInfo->extn_secret_file[0] != '.' || strchr(decInfo->extn_secret_file, '/') != NULL ||
+        strlen(decInfo->extn_secret_file) != (size_t)decInfo->extn_size)
+    {
+        fprintf(stderr, RED"ERROR: Decoded extn invalid\n"RESET);
+        return failure;
+    }
+
+    // "-" writes the secret to stdout as it is decoded
+    if (is_stream_fname(decInfo->secret_fname))
+    {
+        decInfo->fptr_secret = open_output(&decInfo->secret_output, decInfo->secret_fname, NULL, 0);
+        if (decInfo->fptr_secret == NULL)
+            return failure;
+        printf(MAGENTA"INFO: Output written to stdout, extension "RESET);
+        printf(BOLD"%s\n"RESET, decInfo->extn_secret_file);
+        return success;
+    }
+
     // Always construct the output filename based on user's input, but use decoded extension
     char base_name[100];
 
@@ -182,8 +307,10 @@ Status decode_secret_file_extn(DecodeInfo *decInfo)
         return failure;
     }
 
-    // Open output file for writing
-    decInfo->fptr_secret = fopen(decInfo->secret_fname, "w");
+    // Open output file for writing, as a temporary file until decoding is complete
+    decInfo->fptr_secret = open_output(&decInfo->secret_output, decInfo->secret_fname,
+                                       decInfo->io_buffer ? decInfo->io_buffer + IO_BUFFER_SIZE : NULL,
+                                       IO_BUFFER_SIZE);
     if (decInfo->fptr_secret == NULL)
     {
         perror("fopen");
@@ -196,23 +323,60 @@ Status decode_secret_file_extn(DecodeInfo *decInfo)
     return success;
 }
 
+// Payload bytes after the fixed fields, from the header (which may lie, so reads still check for EOF)
+static unsigned long long get_payload_capacity(const char *header)
+{
+    // The file size field also covers a palette, but writers may leave it 0
+    uint file_size;
+    memcpy(&file_size, header + 2, sizeof(file_size));
+    unsigned long long image_bytes = get_pixel_array_size(header);
+    if (file_size > BMP_HEADER_SIZE && file_size - BMP_HEADER_SIZE > image_bytes)
+        image_bytes = file_size - BMP_HEADER_SIZE;
+
+    return image_bytes > FIXED_FIELDS_SIZE ? (image_bytes - FIXED_FIELDS_SIZE) / 8 : 0;
+}
+
 /* Decode secret file size */
 Status decode_secret_file_size(DecodeInfo *decInfo)
 {
     long file_size;
-    // Read 32 image bytes
-    if (fread(decInfo->image_data, 1, 32, decInfo->fptr_src_image) != 32)
-        return failure;
+    if (decInfo->channel_mask != 0)
+    {
+        // Same 32 bits, MSB first, from the selected bytes
+        unsigned char size[4];
+        if (channel_decode_bytes(&decInfo->cursor, (char *)size, 4) == failure)
+            return failure;
+        file_size = ((long)size[0] << 24) | (size[1] << 16) | (size[2] << 8) | size[3];
+    }
+    else
+    {
+        // Read 32 image bytes
+        if (fread(decInfo->image_data, 1, 32, decInfo->fptr_src_image) != 32)
+            return failure;
 
-    if (decode_size_from_lsb(decInfo->image_data, &file_size) == failure)
-        return failure;
+        if (decode_size_from_lsb(decInfo->image_data, &file_size) == failure)
+            return failure;
+    }
 
     if (file_size < 0)
     {
          fprintf(stderr, RED"ERROR: Decoded file size is negative: %ld\n"RESET, file_size);
          return failure;
     }
-    
+
+    // Extension, size and data must fit in the image after the magic string and extn size
+    unsigned long long needed = decInfo->extn_size + 4 + (unsigned long long)file_size;
+    unsigned long long capacity;
+    if (decInfo->channel_mask != 0)
+        capacity = get_channel_capacity(&decInfo->channel_map);
+    else
+        capacity = get_payload_capacity(decInfo->bmp_header);
+    if (needed > capacity)
+    {
+        fprintf(stderr, RED"ERROR: Decoded file size %ld is larger than the image can hold\n"RESET, file_size);
+        return failure;
+    }
+
     decInfo->size_secret_file = file_size;
     printf(MAGENTA"INFO: Secret file size: "RESET);
     printf(BOLD"%ld bytes\n"RESET, file_size);
@@ -223,6 +387,41 @@ Status decode_secret_file_size(DecodeInfo *decInfo)
 Status decode_secret_file_data(DecodeInfo *decInfo)
 {
     char secret_byte;
+
+    if (decInfo->channel_mask != 0)
+    {
+        char data[4096];
+        long left = decInfo->size_secret_file;
+        Status status = success;
+        while (left > 0 && status == success)
+        {
+            uint n = left < (long)sizeof(data) ? (uint)left : (uint)sizeof(data);
+            status = channel_decode_bytes(&decInfo->cursor, data, n);
+            if (status == success && fwrite(data, 1, n, decInfo->fptr_secret) != n)
+                status = failure;
+            left -= n;
+        }
+        close_channel_cursor(&decInfo->cursor);
+        free_channel_map(&decInfo->channel_map);
+        return status;
+    }
+
+    // From the LSB cache, a whole block of payload bytes per read
+    if (decInfo->src_cache != NULL)
+    {
+        char data[4096];
+        long left = decInfo->size_secret_file;
+        while (left > 0)
+        {
+            uint n = left < (long)sizeof(data) ? (uint)left : (uint)sizeof(data);
+            if (decode_data_from_image(n, decInfo->fptr_src_image, data, decInfo) == failure ||
+                fwrite(data, 1, n, decInfo->fptr_secret) != n)
+                return failure;
+            left -= n;
+        }
+        return success;
+    }
+
     for (long i = 0; i < decInfo->size_secret_file; i++)
     {
         // Use a temporary buffer on the stack to read the 8 image bytes
@@ -233,7 +432,8 @@ Status decode_secret_file_data(DecodeInfo *decInfo)
         if (decode_byte_from_lsb(buffer, &secret_byte) == failure)
             return failure;
 
-        fwrite(&secret_byte, 1, 1, decInfo->fptr_secret);
+        if (fwrite(&secret_byte, 1, 1, decInfo->fptr_secret) != 1)
+            return failure;
     }
     return success;
 }
@@ -282,8 +482,15 @@ Status do_decoding(DecodeInfo *decInfo)
         return failure;
     printf(GREEN"SUCCESS: Decoded secret file data\n"RESET);
 
+    // 7. Flush, sync and move the secret file into place
+    decInfo->fptr_secret = NULL;
+    if (commit_output(&decInfo->secret_output) == failure)
+    {
+        fprintf(stderr, RED"ERROR: Unable to write %s\n"RESET, decInfo->secret_fname);
+        return failure;
+    }
+
     printf(YELLOW"INFO: Closing files\n"RESET);
-    fclose(decInfo->fptr_secret);
-    fclose(decInfo->fptr_src_image);
+    close_decode_files(decInfo);
     return success;
 }
\ No newline at end of file
@@ -3,6 +3,10 @@
 
 #include <stdio.h>
 #include "types.h" // Contains user defined types (Status, uint, OperationType)
+#include "common.h" // Contains BMP_HEADER_SIZE
+#include "channel.h" // Contains ChannelMap, ChannelCursor
+#include "output.h" // Contains OutputFile
+#include "cache.h" // Contains CacheReader
 
 /*
  * Structure to store information required for
@@ -13,16 +17,25 @@ typedef struct _DecodeInfo
     /* Source Image info */
     char *src_image_fname;      // To store the src image name (stego image)
     FILE *fptr_src_image;       // To store the address of the src image
+    CacheReader *src_cache;     // Set when fptr_src_image reads the LSB cache sidecar, not the image
+    char bmp_header[BMP_HEADER_SIZE]; // To store the BMP header, read only once
 
     /* Secret File Info */
     char secret_fname[100]; // To store the secret file name
     FILE *fptr_secret;          // To store the secret file address
+    OutputFile secret_output;   // Temporary file renamed to the secret name when done
     char extn_secret_file[5]; // To store the secret file extn (e.g., ".txt")
     long size_secret_file;      // To store the size of the secret data
     int extn_size;              // To store the actual length of the extension (e.g., 4 for ".txt")
 
+    /* Channel mask Info */
+    uint channel_mask;          // CHANNEL_* bits read from the header, 0 for every byte
+    ChannelMap channel_map;     // Gather/scatter table for the mask
+    ChannelCursor cursor;       // Position in the selected bytes
+
     /* Other Data */
     char image_data[100 * 8]; // To hold image data during decoding
+    char *io_buffer;          // Optional caller-owned buffer of 2 * IO_BUFFER_SIZE for the streams
 
 } DecodeInfo;
 
@@ -37,6 +50,9 @@ Status do_decoding(DecodeInfo *decInfo);
 /* Get File pointers for i/p and o/p files */
 Status open_files_decode(DecodeInfo *decInfo);
 
+/* Close whatever files are still open and release buffers */
+void close_decode_files(DecodeInfo *decInfo);
+
 /* Decode Magic String */
 Status decode_magic_string(const char *magic_string, DecodeInfo *decInfo);
 
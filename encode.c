@@ -1,6 +1,10 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include "encode.h"
+#include "stream.h"
+#include "adaptive.h"
 #include "common.h"
 #include "colour.h"
 
@@ -13,29 +17,155 @@
  * and height after that. size is 4 bytes
  */
 // Get image size for BMP
-uint get_image_size_for_bmp(FILE *fptr_image)
+unsigned long long get_image_size_for_bmp(FILE *fptr_image)
 {
-    uint width, height;
-    // Seek to 18th byte
-    fseek(fptr_image, 18, SEEK_SET);
+    char header[BMP_HEADER_SIZE];
 
-    // Read the width (an int)
-    fread(&width, sizeof(int), 1, fptr_image);
-    printf(MAGENTA"     Width = "RESET BOLD"%u pxls\n"RESET, width);
+    // Read the header from the start of the file
+    rewind(fptr_image);
+    if (read_bmp_header(fptr_image, header) == failure)
+        return 0;
+
+    return get_image_size_from_header(header);
+}
 
-    // Read the height (an int)
-    fread(&height, sizeof(int), 1, fptr_image);
+/* Get image size from header
+ * Input: BMP header already read from the image
+ * Output: width * height * bytes per pixel (3 in our case)
+ * Description: Same as get_image_size_for_bmp() but without any
+ * seeking, so it also works when the image comes from a pipe. Worked
+ * out in 64 bits, like get_pixel_array_size().
+ */
+unsigned long long get_image_size_from_header(const char *header)
+{
+    uint width, height, bpp;
+
+    get_bmp_dimensions(header, &width, &height, &bpp);
+    printf(MAGENTA"     Width = "RESET BOLD"%u pxls\n"RESET, width);
     printf(MAGENTA"     Height = "RESET BOLD"%u pxls\n"RESET, height);
 
     // Return image capacity
-    return width * height * 3;
+    return (unsigned long long)width * height * 3;
+}
+
+/* Get pixel array size from header
+ * Input: BMP header already read from the image
+ * Output: row stride (rows padded to 4 bytes) * height
+ * Description: Computed in 64 bits so hostile dimensions can't wrap
+ */
+unsigned long long get_pixel_array_size(const char *header)
+{
+    uint width, height, bpp;
+
+    get_bmp_dimensions(header, &width, &height, &bpp);
+    return ((unsigned long long)width * bpp + 31) / 32 * 4 * height;
+}
+
+/* Get row stride from header
+ * Input: BMP header already read from the image
+ * Output: bytes per row, padded to 4 bytes
+ * Description: width * bpp counts bits, so it is worked out in 64 bits;
+ * read_bmp_header() has checked that the result fits in a uint
+ */
+uint get_row_stride(const char *header)
+{
+    uint width, height, bpp;
+
+    get_bmp_dimensions(header, &width, &height, &bpp);
+    return (uint)(((unsigned long long)width * bpp + 31) / 32 * 4);
+}
+
+/* Check that a seekable image holds the pixel array its header describes
+ * Description: Channel tables and the complexity map are sized from the
+ * header alone, so an image cut short is rejected before they are
+ * allocated. A pipe can't be checked and is read as far as it goes.
+ * The position is left where it was.
+ */
+Status check_pixel_array_size(FILE *fptr_image, const char *header)
+{
+    long start = ftell(fptr_image);
+    if (start < 0 || fseek(fptr_image, 0, SEEK_END) != 0)
+        return success; // Not seekable
+    long end = ftell(fptr_image);
+    if (fseek(fptr_image, start, SEEK_SET) != 0)
+        return failure;
+
+    if (end < BMP_HEADER_SIZE || (unsigned long long)(end - BMP_HEADER_SIZE) < get_pixel_array_size(header))
+    {
+        fprintf(stderr, RED"ERROR: Pixel array is truncated\n"RESET);
+        return failure;
+    }
+    return success;
+}
+
+/* Get image dimensions from header
+ * Input: BMP header already read from the image
+ * Output: width, height (always positive) and bits per pixel
+ * Description: width is at offset 18, height at 22 (negative for
+ * top-down images), bits per pixel is a 2 byte value at offset 28
+ */
+void get_bmp_dimensions(const char *header, uint *width, uint *height, uint *bpp)
+{
+    int w, h;
+    unsigned short bits;
+
+    memcpy(&w, header + 18, sizeof(int));
+    memcpy(&h, header + 22, sizeof(int));
+    memcpy(&bits, header + 28, sizeof(bits));
+
+    *width = (uint)w;
+    *height = h < 0 ? 0u - (uint)h : (uint)h;
+    *bpp = bits;
 }
 
-// Get file size
-uint get_file_size(FILE *fptr)
+/* Get file size
+ * Description: Uses fstat() so the file position is not moved. The size
+ * is hidden before the data, so a secret that is not a regular file (a
+ * pipe, <(cmd)) is first copied to an anonymous temporary file, which
+ * then replaces *fptr.
+ */
+Status get_file_size(FILE **fptr, uint *size)
 {
-    fseek(fptr, 0, SEEK_END);
-    return ftell(fptr);
+    struct stat st;
+    if (fstat(fileno(*fptr), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        if ((unsigned long long)st.st_size > 0xFFFFFFFFULL)
+        {
+            fprintf(stderr, RED"ERROR: Secret file is larger than 4 GiB\n"RESET);
+            return failure;
+        }
+        *size = st.st_size;
+        return success;
+    }
+
+    FILE *fptr_spool = tmpfile();
+    if (fptr_spool == NULL)
+    {
+        perror(RED"ERROR: Unable to create temporary file for the secret"RESET);
+        return failure;
+    }
+
+    char buffer[4096];
+    size_t n;
+    unsigned long long total = 0;
+    while ((n = fread(buffer, 1, sizeof(buffer), *fptr)) > 0 && total <= 0xFFFFFFFFULL)
+    {
+        if (fwrite(buffer, 1, n, fptr_spool) != n)
+            break;
+        total += n;
+    }
+    if (ferror(*fptr) || ferror(fptr_spool) || total > 0xFFFFFFFFULL ||
+        fflush(fptr_spool) != 0 || fseek(fptr_spool, 0, SEEK_SET) != 0)
+    {
+        fprintf(stderr, RED"ERROR: Unable to read the secret\n"RESET);
+        fclose(fptr_spool);
+        return failure;
+    }
+
+    fclose(*fptr);
+    *fptr = fptr_spool;
+    *size = total;
+    return success;
 }
 
 // Validate and read arguments
@@ -50,7 +180,7 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     }
 
     char *img_dot = strrchr(argv[2], '.'); // last dot in filename
-    if (img_dot == NULL || strcmp(img_dot, ".bmp") != 0) {
+    if (!is_stream_fname(argv[2]) && (img_dot == NULL || strcmp(img_dot, ".bmp") != 0)) {
         printf(RED "ERROR: Source image file must be .bmp\n" RESET);
         return failure;
     }
@@ -102,7 +232,7 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     /* Output stego filename (optional argv[4]) */
     if (argv[4] != NULL) {
         char *o_dot = strrchr(argv[4], '.'); // last dot in filename
-        if (o_dot == NULL || strcmp(o_dot, ".bmp") != 0) {
+        if (!is_stream_fname(argv[4]) && (o_dot == NULL || strcmp(o_dot, ".bmp") != 0)) {
             printf(RED "ERROR: Destination image file must be .bmp\n" RESET);
             return failure;
         }
@@ -119,12 +249,17 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 Status open_files(EncodeInfo *encInfo)
 {
     printf(YELLOW"INFO: Opening source file\n"RESET);
-    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
+    if (is_stream_fname(encInfo->src_image_fname))
+        encInfo->fptr_src_image = stdin;
+    else
+        encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r");
     if (!encInfo->fptr_src_image)
     {
         perror(RED"ERROR: Unable to open source image file"RED);
         return failure;
     }
+    if (encInfo->io_buffer != NULL && encInfo->fptr_src_image != stdin)
+        setvbuf(encInfo->fptr_src_image, encInfo->io_buffer, _IOFBF, IO_BUFFER_SIZE);
     printf(GREEN"SUCCESS: Source file opened:"RESET BOLD"%s\n"RESET,encInfo -> src_image_fname);
 
     printf(YELLOW"INFO: Opening secret file\n"RESET);
@@ -136,7 +271,10 @@ Status open_files(EncodeInfo *encInfo)
     }
     printf(GREEN"SUCCESS: Secret file opened:"RESET BOLD"%s\n"RESET,encInfo -> secret_fname);
 
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "w");
+    // Written to a temporary file until encoding is complete
+    encInfo->fptr_stego_image = open_output(&encInfo->stego_output, encInfo->stego_image_fname,
+                                            encInfo->io_buffer ? encInfo->io_buffer + IO_BUFFER_SIZE : NULL,
+                                            IO_BUFFER_SIZE);
     if (!encInfo->fptr_stego_image)
     {
         perror(RED"ERROR: Unable to open output file"RED);
@@ -146,32 +284,104 @@ Status open_files(EncodeInfo *encInfo)
     return success;
 }
 
+/* Close whatever files are still open and release buffers
+ * Description: Safe to call after a failure at any step, and more than
+ * once; every pointer is reset to NULL once it is closed.
+ */
+void close_encode_files(EncodeInfo *encInfo)
+{
+    if (encInfo->fptr_secret != NULL)
+        fclose(encInfo->fptr_secret);
+    if (encInfo->fptr_src_image != NULL && encInfo->fptr_src_image != stdin)
+        fclose(encInfo->fptr_src_image);
+    // A stego image that was not committed is removed
+    abort_output(&encInfo->stego_output);
+    encInfo->fptr_secret = NULL;
+    encInfo->fptr_src_image = NULL;
+    encInfo->fptr_stego_image = NULL;
+
+    free(encInfo->cursor.row);
+    free(encInfo->cursor.selected);
+    encInfo->cursor.row = NULL;
+    encInfo->cursor.selected = NULL;
+    free_channel_map(&encInfo->channel_map);
+}
+
 // Check capacity
 Status check_capacity(EncodeInfo *encInfo)
 {
-    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image);
-    encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);
+    /* The header is read only once here and kept for copy_bmp_header(),
+    so the source image is never rewound (it may be a pipe) */
+    if (read_bmp_header(encInfo->fptr_src_image, encInfo->bmp_header) == failure)
+        return failure;
+    encInfo->image_capacity = get_image_size_from_header(encInfo->bmp_header);
+    uint secret_size;
+    if (get_file_size(&encInfo->fptr_secret, &secret_size) == failure)
+        return failure;
+    encInfo->size_secret_file = secret_size;
     /* Calculate total number of bits required to embed: BMP header (54 bytes),
     magic string, extension size, file extension, secret file size, and the
     entire secret file data */
     uint file_capacity = (54 + strlen(MAGIC_STRING) * 8 + sizeof(int) * 8 + strlen(encInfo->extn_secret_file) * 8 + 
                             sizeof(long) * 8 + encInfo->size_secret_file * 8);
+
+    /* With a channel mask only the selected bytes after the fixed fields
+    (magic string and extn size) can hold the extension, size and data */
+    if (encInfo->adaptive && encInfo->channel_mask == 0)
+        encInfo->channel_mask = CHANNEL_B | CHANNEL_G | CHANNEL_R;
+    if (encInfo->channel_mask != 0)
+    {
+        if (check_pixel_array_size(encInfo->fptr_src_image, encInfo->bmp_header) == failure ||
+            build_channel_map(&encInfo->channel_map, encInfo->channel_mask, encInfo->bmp_header) == failure)
+            return failure;
+        unsigned long long needed = strlen(encInfo->extn_secret_file) + 4 + encInfo->size_secret_file;
+
+        /* Adaptive: capacity comes from the complexity map, which needs a
+        pass over the pixel array before embedding */
+        if (encInfo->adaptive)
+        {
+            if (is_stream_fname(encInfo->src_image_fname))
+            {
+                printf(RED"ERROR: Adaptive mode needs a source image file, not stdin\n"RESET);
+                return failure;
+            }
+            if (build_complexity_map(&encInfo->channel_map, encInfo->fptr_src_image) == failure ||
+                fseek(encInfo->fptr_src_image, BMP_HEADER_SIZE, SEEK_SET) != 0)
+                return failure;
+            if (choose_adaptive_threshold(&encInfo->channel_map, needed) == 0)
+            {
+                printf(RED"ERROR: Not enough textured pixels for the secret data\n"RESET);
+                return failure;
+            }
+            printf(MAGENTA"     Adaptive threshold = "RESET BOLD"%u\n"RESET, encInfo->channel_map.threshold);
+        }
+
+        unsigned long long mask_capacity = get_channel_capacity(&encInfo->channel_map);
+        printf(MAGENTA"     %s capacity = "RESET BOLD"%llu bytes\n"RESET,
+               encInfo->adaptive ? "Adaptive" : "Channel mask", mask_capacity);
+        if (mask_capacity < needed)
+        {
+            printf(RED"ERROR: Image does not have enough capacity for the channel mask: "RESET);
+            printf("%llu bytes/%llu bytes", needed, mask_capacity);
+            return failure;
+        }
+        return success;
+    }
+
     if (encInfo->image_capacity < file_capacity)
     {
         printf(RED"ERROR: Image does not have enough capacity: "RESET);
-        printf("%u bytes/%u bytes",file_capacity, encInfo -> image_capacity);
+        printf("%u bytes/%llu bytes",file_capacity, encInfo -> image_capacity);
         return failure;
     }
     return success;
 }
 
-// Copy BMP header (first 54 bytes)
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image)
+// Copy BMP header (first 54 bytes, already read by check_capacity)
+Status copy_bmp_header(const char *header, FILE *fptr_dest_image)
 {
-    char header[54];
-    rewind(fptr_src_image);
-    fread(header, 54, 1, fptr_src_image);
-    fwrite(header, 54, 1, fptr_dest_image);
+    if (fwrite(header, BMP_HEADER_SIZE, 1, fptr_dest_image) != 1)
+        return failure;
     return success;
 }
 
@@ -221,6 +431,9 @@ Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
 // Encode secret file extn
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
 {
+    if (encInfo->channel_mask != 0)
+        return channel_encode_bytes(&encInfo->cursor, file_extn, strlen(file_extn));
+
     char buffer[8];
     for (int i = 0; i < strlen(file_extn); i++)
     {
@@ -234,6 +447,13 @@ Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
 // Encode secret file size
 Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
 {
+    if (encInfo->channel_mask != 0)
+    {
+        // Same 32 bits, MSB first, as encode_size_to_lsb()
+        char size[4] = { file_size >> 24, file_size >> 16, file_size >> 8, file_size };
+        return channel_encode_bytes(&encInfo->cursor, size, 4);
+    }
+
     char buffer[32];
     fread(buffer, 32, 1, encInfo->fptr_src_image);
     encode_size_to_lsb(file_size, buffer);
@@ -245,7 +465,18 @@ Status encode_secret_file_size(long file_size, EncodeInfo *encInfo)
 Status encode_secret_file_data(EncodeInfo *encInfo)
 {
     char ch, buffer[8];
-    rewind(encInfo->fptr_secret);
+
+    if (encInfo->channel_mask != 0)
+    {
+        char data[4096];
+        size_t n;
+        while ((n = fread(data, 1, sizeof(data), encInfo->fptr_secret)) > 0)
+        {
+            if (channel_encode_bytes(&encInfo->cursor, data, n) == failure)
+                return failure;
+        }
+        return success;
+    }
 
     while (fread(&ch, 1, 1, encInfo->fptr_secret) > 0)
     {
@@ -257,12 +488,16 @@ Status encode_secret_file_data(EncodeInfo *encInfo)
     return success;
 }
 
-// Copy remaining data after encoding
+// Copy remaining data after encoding, one chunk at a time
 Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
 {
-    char ch;
-    while (fread(&ch, 1, 1, fptr_src) > 0)
-        fwrite(&ch, 1, 1, fptr_dest);
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fptr_src)) > 0)
+    {
+        if (fwrite(buffer, 1, n, fptr_dest) != n)
+            return failure;
+    }
     return success;
 }
 
@@ -287,7 +522,7 @@ Status do_encoding(EncodeInfo *encInfo)
 
     // 3. Copy BMP Header (54 bytes)
     printf(YELLOW"INFO: Copying BMP header\n"RESET);
-    if (copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image) == failure) {
+    if (copy_bmp_header(encInfo->bmp_header, encInfo->fptr_stego_image) == failure) {
         fprintf(stderr, RED"ERROR: Failed to copy BMP header\n"RESET);
         return failure;
     }
@@ -303,13 +538,22 @@ Status do_encoding(EncodeInfo *encInfo)
 
     // 5. Encode Secret File Extension Size
     printf(YELLOW"INFO: Encoding secret file extension size\n"RESET);
-    int extn_size = strlen(encInfo->extn_secret_file);
+    int extn_size = strlen(encInfo->extn_secret_file) | (encInfo->channel_mask << CHANNEL_MASK_SHIFT) |
+                    (encInfo->channel_map.threshold << ADAPTIVE_SHIFT);
     if (encode_secret_file_extn_size(extn_size, encInfo) == failure) {
         fprintf(stderr, RED"ERROR: Failed to encode secret file extension size\n"RESET);
         return failure;
     }
     printf(GREEN"SUCCESS: Encoding Secret File Extension Size done\n"RESET);
 
+    // The rest goes only in the bytes selected by the channel mask
+    if (encInfo->channel_mask != 0 &&
+        open_channel_cursor(&encInfo->cursor, &encInfo->channel_map,
+                            encInfo->fptr_src_image, encInfo->fptr_stego_image) == failure) {
+        fprintf(stderr, RED"ERROR: Failed to start channel mask embedding\n"RESET);
+        return failure;
+    }
+
     // 6. Encode Secret File Extension (e.g., ".txt")
     printf(YELLOW"INFO: Encoding secret file extension\n"RESET);
     if (encode_secret_file_extn(encInfo->extn_secret_file, encInfo) == failure) {
@@ -336,15 +580,29 @@ Status do_encoding(EncodeInfo *encInfo)
 
     // 9. Copy Remaining Image Data
     printf(YELLOW"INFO: Copying remaining Image data\n"RESET);
+    if (encInfo->channel_mask != 0) {
+        Status status = close_channel_cursor(&encInfo->cursor);
+        free_channel_map(&encInfo->channel_map);
+        if (status == failure) {
+            fprintf(stderr, RED"ERROR: Failed to write last channel mask row\n"RESET);
+            return failure;
+        }
+    }
     if (copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image) == failure) {
         fprintf(stderr, RED"ERROR: Failed to copy remaining image data\n"RESET);
         return failure;
     }
     printf(GREEN"SUCCESS: Copying remaining Image data done\n"RESET);
 
+    // Flush, sync and move the stego image into place
+    encInfo->fptr_stego_image = NULL;
+    if (commit_output(&encInfo->stego_output) == failure) {
+        fprintf(stderr, RED"ERROR: Unable to write stego image\n"RESET);
+        return failure;
+    }
+
     // All steps successful
     printf(YELLOW"INFO: Closing files\n"RESET);
-    fclose(encInfo->fptr_secret);
-    fclose(encInfo->fptr_src_image);
+    close_encode_files(encInfo);
     return success;
 }
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include <stdio.h>
 
 #include "types.h" // Contains user defined types
+#include "common.h" // Contains BMP_HEADER_SIZE
+#include "channel.h" // Contains ChannelMap, ChannelCursor
+#include "output.h" // Contains OutputFile
 
 /*
  * Structure to store information required for
@@ -16,7 +19,8 @@ typedef struct _EncodeInfo
     /* Source Image info */
     char *src_image_fname; // To store the src image name
     FILE *fptr_src_image;  // To store the address of the src image
-    uint image_capacity;   // To store the size of image
+    unsigned long long image_capacity; // To store the size of image
+    char bmp_header[BMP_HEADER_SIZE]; // To store the BMP header, read only once
 
     /* Secret File Info */
     char *secret_fname;       // To store the secret file name
@@ -28,6 +32,16 @@ typedef struct _EncodeInfo
     /* Stego Image Info */
     char *stego_image_fname; // To store the dest file name
     FILE *fptr_stego_image;  // To store the address of stego image
+    OutputFile stego_output; // Temporary file renamed to the dest name when done
+
+    /* Channel mask Info */
+    uint channel_mask;       // CHANNEL_* bits to embed in, 0 for every byte
+    uint adaptive;           // Embed only in textured pixels (edge-adaptive)
+    ChannelMap channel_map;  // Gather/scatter table for the mask
+    ChannelCursor cursor;    // Position in the selected bytes
+
+    /* Optional caller-owned buffer of 2 * IO_BUFFER_SIZE for the image streams */
+    char *io_buffer;
 
 } EncodeInfo;
 
@@ -42,17 +56,35 @@ Status do_encoding(EncodeInfo *encInfo);
 /* Get File pointers for i/p and o/p files */
 Status open_files(EncodeInfo *encInfo);
 
+/* Close whatever files are still open and release buffers */
+void close_encode_files(EncodeInfo *encInfo);
+
 /* check capacity */
 Status check_capacity(EncodeInfo *encInfo);
 
 /* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
+unsigned long long get_image_size_for_bmp(FILE *fptr_image);
+
+/* Get image size from an already read BMP header */
+unsigned long long get_image_size_from_header(const char *header);
+
+/* Get width, height and bits per pixel from an already read BMP header */
+void get_bmp_dimensions(const char *header, uint *width, uint *height, uint *bpp);
+
+/* Get pixel array size (padded rows) from an already read BMP header */
+unsigned long long get_pixel_array_size(const char *header);
+
+/* Get bytes per padded row from an already read BMP header */
+uint get_row_stride(const char *header);
+
+/* Check that a seekable image holds the pixel array its header describes */
+Status check_pixel_array_size(FILE *fptr_image, const char *header);
 
-/* Get file size */
-uint get_file_size(FILE *fptr);
+/* Get file size, copying a secret that is not a regular file to a temporary file */
+Status get_file_size(FILE **fptr, uint *size);
 
 /* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+Status copy_bmp_header(const char *header, FILE *fptr_dest_image);
 
 /* Store Magic String */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
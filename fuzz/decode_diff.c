@@ -0,0 +1,592 @@
+/* Differential test of the encode and decode paths
+ * Description: For random covers (24/32 bpp, odd widths, both row
+ * orders) and random payloads, encodes with ./steg plain, with a random
+ * -m mask, and with --adaptive. Plain and masked stego images must match
+ * a scalar reference embedding byte for byte. Every image is then
+ * decoded from the file, from a pipe (stdin for adaptive images, which
+ * need to seek), with --cache (building the sidecar, then reading it)
+ * and in one -b batch, and each output must match the payload.
+ *
+ * Plain images are updated in place with -u to a new random secret; the
+ * image must match the reference embedding of it over the old one and
+ * decode to it. -u must refuse masked and adaptive images untouched.
+ * The -q changed-byte counts and MSE must match a scalar reference.
+ *
+ * Given a second ./steg built without SSE2 (-U__SSE2__), the -a reports
+ * of every cover and stego image and the -q reports of every pair must
+ * be the same from both builds (timings aside), which checks the SIMD
+ * RS counts and compare loops against the scalar ones.
+ *
+ *   gcc -O2 fuzz/decode_diff.c -o decode_diff
+ *   gcc -O2 -U__SSE2__ *.c -o steg_scalar -pthread -lm
+ *   ./decode_diff ./steg [cases] [seed] [./steg_scalar]
+ *
+ * Exit status 1 if anything differs; the work directory is then kept.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+
+#define HEADER_SIZE 54
+#define FIXED_FIELDS_SIZE 48 // Magic string and extn word, always in every byte
+
+/* One generated case */
+typedef struct _DiffCase
+{
+    unsigned width, height, bpp;
+    int top_down;       // Negative height in the header
+    unsigned mask;      // CHANNEL_* bits, 0 for every byte
+    int adaptive;       // --adaptive
+    const char *extn;   // Secret file extension
+    unsigned char *secret;
+    unsigned secret_size;
+    int encoded;        // ./steg accepted it
+} DiffCase;
+
+static unsigned long long rng_state;
+static int failures = 0;
+static int checks = 0;
+
+// xorshift64*, so a seed gives the same cases everywhere
+static unsigned rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (unsigned)((rng_state * 2685821657736338717ULL) >> 32);
+}
+
+static void put_le32(unsigned char *p, unsigned v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static unsigned row_stride(const DiffCase *dc)
+{
+    return (dc->width * dc->bpp + 31) / 32 * 4;
+}
+
+// Whole file in memory, NULL if missing
+static unsigned char *read_file(const char *fname, size_t *size)
+{
+    FILE *fptr = fopen(fname, "r");
+    if (fptr == NULL)
+        return NULL;
+    fseek(fptr, 0, SEEK_END);
+    long len = ftell(fptr);
+    rewind(fptr);
+    unsigned char *data = malloc(len > 0 ? len : 1);
+    if (data != NULL && fread(data, 1, len, fptr) != (size_t)len)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(fptr);
+    *size = len;
+    return data;
+}
+
+static int write_file(const char *fname, const unsigned char *data, size_t size)
+{
+    FILE *fptr = fopen(fname, "w");
+    if (fptr == NULL)
+        return -1;
+    int ok = fwrite(data, 1, size, fptr) == size;
+    return fclose(fptr) == 0 && ok ? 0 : -1;
+}
+
+static void report(int id, const DiffCase *dc, const char *what)
+{
+    failures++;
+    printf("[FAILED] case %d (%ux%u%s, %u bpp, mask 0x%x%s, %u bytes %s): %s\n", id, dc->width, dc->height,
+           dc->top_down ? " top-down" : "", dc->bpp, dc->mask, dc->adaptive ? ", adaptive" : "",
+           dc->secret_size, dc->extn, what);
+}
+
+// Compare a file with the expected bytes
+static void check_file(int id, const DiffCase *dc, const char *fname, const unsigned char *expected, size_t size, const char *what)
+{
+    size_t len;
+    unsigned char *data = read_file(fname, &len);
+    checks++;
+    if (data == NULL || len != size || memcmp(data, expected, size) != 0)
+    {
+        char msg[160];
+        snprintf(msg, sizeof(msg), "%s differs (%s)", what, data == NULL ? "missing" : "wrong bytes");
+        report(id, dc, msg);
+    }
+    free(data);
+}
+
+// Cover with flat, noisy, gradient and clipped rows, so adaptive maps vary
+static unsigned char *make_cover(const DiffCase *dc, size_t *size)
+{
+    unsigned stride = row_stride(dc);
+    *size = HEADER_SIZE + (size_t)stride * dc->height;
+    unsigned char *image = calloc(*size, 1);
+    if (image == NULL)
+        return NULL;
+
+    image[0] = 'B';
+    image[1] = 'M';
+    put_le32(image + 2, (unsigned)*size);
+    put_le32(image + 10, HEADER_SIZE);
+    put_le32(image + 14, 40);
+    put_le32(image + 18, dc->width);
+    put_le32(image + 22, dc->top_down ? (unsigned)-(int)dc->height : dc->height);
+    image[26] = 1;
+    image[28] = dc->bpp;
+    put_le32(image + 34, stride * dc->height);
+    put_le32(image + 38, 2835);
+    put_le32(image + 42, 2835);
+
+    for (unsigned y = 0; y < dc->height; y++)
+    {
+        unsigned char *row = image + HEADER_SIZE + (size_t)y * stride;
+        unsigned kind = rng() % 4, base = rng() & 0xFF;
+        for (unsigned i = 0; i < stride; i++)
+        {
+            if (kind == 0)
+                row[i] = base;
+            else if (kind == 1)
+                row[i] = base + i;
+            else if (kind == 2)
+                row[i] = (rng() & 1) ? 0 : 255;
+            else
+                row[i] = rng();
+        }
+    }
+    return image;
+}
+
+// Scalar reference: the bits of data, MSB first, into the LSBs of the listed bytes
+typedef struct _BitWriter
+{
+    unsigned char *image;
+    const DiffCase *dc;
+    size_t pos;     // Next pixel byte when every byte is used
+    unsigned row;   // Next row, slot and channel when masked
+    unsigned x, c;
+} BitWriter;
+
+static void put_bit(BitWriter *bw, int bit)
+{
+    unsigned char *p;
+    if (bw->dc->mask == 0)
+        p = bw->image + HEADER_SIZE + bw->pos++;
+    else
+    {
+        unsigned channels = bw->dc->bpp / 8;
+        while (!(bw->dc->mask & (1u << bw->c)))
+        {
+            if (++bw->c == channels)
+            {
+                bw->c = 0;
+                if (++bw->x == bw->dc->width)
+                {
+                    bw->x = 0;
+                    bw->row++;
+                }
+            }
+        }
+        p = bw->image + HEADER_SIZE + (size_t)bw->row * row_stride(bw->dc) + bw->x * channels + bw->c;
+        if (++bw->c == channels)
+        {
+            bw->c = 0;
+            if (++bw->x == bw->dc->width)
+            {
+                bw->x = 0;
+                bw->row++;
+            }
+        }
+    }
+    *p = (*p & 0xFE) | bit;
+}
+
+static void put_bytes(BitWriter *bw, const unsigned char *data, unsigned len)
+{
+    for (unsigned i = 0; i < len; i++)
+        for (int k = 7; k >= 0; k--)
+            put_bit(bw, (data[i] >> k) & 1);
+}
+
+static void put_word(BitWriter *bw, unsigned v)
+{
+    unsigned char be[4] = { v >> 24, v >> 16, v >> 8, v };
+    put_bytes(bw, be, 4);
+}
+
+static void reference_encode(const DiffCase *dc, unsigned char *image)
+{
+    unsigned extn_size = strlen(dc->extn);
+
+    // Magic string and extn word always take the first 48 bytes
+    DiffCase fixed = *dc;
+    fixed.mask = 0;
+    BitWriter bw = { image, &fixed, 0, 0, 0, 0 };
+    put_bytes(&bw, (const unsigned char *)"#*", 2);
+    put_word(&bw, extn_size | dc->mask << 8);
+
+    if (dc->mask != 0)
+    {
+        unsigned stride = row_stride(dc);
+        bw.dc = dc;
+        bw.row = (FIXED_FIELDS_SIZE + stride - 1) / stride;
+    }
+    put_bytes(&bw, (const unsigned char *)dc->extn, extn_size);
+    put_word(&bw, dc->secret_size);
+    put_bytes(&bw, dc->secret, dc->secret_size);
+}
+
+// Largest secret that fits, 0 if none
+static unsigned max_secret_size(const DiffCase *dc)
+{
+    long long extn_size = strlen(dc->extn);
+    long long room;
+    if (dc->mask == 0)
+        room = ((long long)dc->width * dc->height * 3 - HEADER_SIZE - 16 - 32 - extn_size * 8 - 64) / 8;
+    else
+    {
+        unsigned stride = row_stride(dc);
+        unsigned first_row = (FIXED_FIELDS_SIZE + stride - 1) / stride;
+        unsigned per_pixel = __builtin_popcount(dc->mask);
+        long long rows = dc->height > first_row ? dc->height - first_row : 0;
+        room = rows * dc->width * per_pixel / 8 - extn_size - 4;
+        if (dc->adaptive)
+            room /= 16; // Only the textured pixels are used
+    }
+    return room > 0 ? (unsigned)room : 0;
+}
+
+static void mask_arg(unsigned mask, char *arg)
+{
+    const char *names = "bgra";
+    int n = 0;
+    for (int c = 0; c < 4; c++)
+        if (mask & (1u << c))
+            arg[n++] = names[c];
+    arg[n] = '\0';
+}
+
+static int run(const char *cmd)
+{
+    return system(cmd) == 0 ? 0 : -1;
+}
+
+// stdout of cmd without the lines containing skip (timings), NULL if it failed
+static char *capture(const char *cmd, const char *skip)
+{
+    FILE *pipe = popen(cmd, "r");
+    if (pipe == NULL)
+        return NULL;
+
+    size_t size = 0, capacity = 4096;
+    char *out = malloc(capacity), line[1024];
+    while (out != NULL && fgets(line, sizeof(line), pipe) != NULL)
+    {
+        if (strstr(line, skip) != NULL)
+            continue;
+        size_t len = strlen(line);
+        if (size + len + 1 > capacity)
+        {
+            char *grown = realloc(out, capacity = 2 * (size + len + 1));
+            if (grown == NULL)
+                free(out);
+            out = grown;
+        }
+        if (out != NULL)
+        {
+            memcpy(out + size, line, len);
+            size += len;
+        }
+    }
+    if (pclose(pipe) != 0 || out == NULL)
+    {
+        free(out);
+        return NULL;
+    }
+    out[size] = '\0';
+    return out;
+}
+
+// The same report from both builds
+static void check_same_report(int id, const DiffCase *dc, const char *steg, const char *steg_scalar,
+                              const char *args, const char *skip, const char *what)
+{
+    char cmd[2 * PATH_MAX + 256];
+    snprintf(cmd, sizeof(cmd), "'%s' %s 2>/dev/null", steg, args);
+    char *simd = capture(cmd, skip);
+    snprintf(cmd, sizeof(cmd), "'%s' %s 2>/dev/null", steg_scalar, args);
+    char *scalar = capture(cmd, skip);
+
+    checks++;
+    if (simd == NULL || scalar == NULL || strcmp(simd, scalar) != 0)
+    {
+        char msg[160];
+        snprintf(msg, sizeof(msg), "%s differs from the scalar build (%s)", what,
+                 simd == NULL || scalar == NULL ? "failed" : "different report");
+        report(id, dc, msg);
+    }
+    free(simd);
+    free(scalar);
+}
+
+// -q changed bytes and MSE of every channel against a plain loop over both images
+static void check_quality(int id, const DiffCase *dc, const char *steg, const char *cover_fname, const char *stego_fname)
+{
+    static const char *names[4] = { "blue", "green", "red", "alpha" };
+    size_t cover_size, stego_size;
+    unsigned char *cover = read_file(cover_fname, &cover_size);
+    unsigned char *stego = read_file(stego_fname, &stego_size);
+    char cmd[PATH_MAX + 256];
+    snprintf(cmd, sizeof(cmd), "'%s' -q %s %s 2>/dev/null", steg, cover_fname, stego_fname);
+    char *json = capture(cmd, "\"seconds\"");
+
+    checks++;
+    if (cover == NULL || stego == NULL || json == NULL || cover_size != stego_size)
+        report(id, dc, "-q failed");
+    else
+    {
+        unsigned channels = dc->bpp / 8;
+        unsigned long long changed[4] = {0}, squared[4] = {0};
+        for (unsigned y = 0; y < dc->height; y++)
+        {
+            size_t row = HEADER_SIZE + (size_t)y * row_stride(dc);
+            for (unsigned i = 0; i < dc->width * channels; i++)
+            {
+                int diff = cover[row + i] - stego[row + i];
+                changed[i % channels] += diff != 0;
+                squared[i % channels] += diff * diff;
+            }
+        }
+
+        for (unsigned c = 0; c < channels; c++)
+        {
+            char expected[160];
+            snprintf(expected, sizeof(expected), "\"%s\": { \"changed_bytes\": %llu, \"mse\": %.6f,", names[c],
+                     changed[c], (double)squared[c] / ((unsigned long long)dc->width * dc->height));
+            if (strstr(json, expected) == NULL)
+            {
+                report(id, dc, "-q report differs from the reference");
+                break;
+            }
+        }
+    }
+    free(cover);
+    free(stego);
+    free(json);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <steg binary> [cases] [seed] [steg binary without SSE2]\n", argv[0]);
+        return 2;
+    }
+    char steg[PATH_MAX], steg_scalar[PATH_MAX];
+    if (realpath(argv[1], steg) == NULL || (argc > 4 && realpath(argv[4], steg_scalar) == NULL))
+    {
+        perror(argc > 4 ? argv[4] : argv[1]);
+        return 2;
+    }
+    int compare_builds = argc > 4;
+    int ncases = argc > 2 ? atoi(argv[2]) : 50;
+    unsigned long long seed = argc > 3 ? strtoull(argv[3], NULL, 0) : 1;
+    rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    char dir[] = "/tmp/decode_diff.XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0)
+    {
+        perror("work directory");
+        return 2;
+    }
+
+    const char *extns[] = { ".txt", ".c", ".h", ".sh", ".py" }; // The ones -e accepts
+    DiffCase *cases = calloc(ncases, sizeof(DiffCase));
+    FILE *jobs = fopen("jobs.txt", "w");
+    if (cases == NULL || jobs == NULL)
+        return 2;
+
+    char cmd[2 * PATH_MAX + 256];
+    int skipped = 0;
+    for (int id = 0; id < ncases; id++)
+    {
+        DiffCase *dc = &cases[id];
+        do
+        {
+            dc->width = 1 + rng() % 160;
+            dc->height = 1 + rng() % 120;
+            dc->bpp = rng() % 2 ? 24 : 32;
+            dc->top_down = rng() % 4 == 0;
+            dc->extn = extns[rng() % 5];
+            unsigned kind = rng() % 4; // Plain, mask, adaptive, adaptive with a mask
+            dc->adaptive = kind >= 2;
+            dc->mask = 0;
+            if (kind == 1 || kind == 3)
+                while (dc->mask == 0)
+                    dc->mask = rng() & ((1u << (dc->bpp / 8)) - 1);
+            else if (kind == 2)
+                dc->mask = 0x7; // --adaptive alone uses b, g and r
+        } while (max_secret_size(dc) == 0);
+
+        dc->secret_size = 1 + rng() % max_secret_size(dc);
+        dc->secret = malloc(dc->secret_size);
+        if (dc->secret == NULL)
+            return 2;
+        for (unsigned i = 0; i < dc->secret_size; i++)
+            dc->secret[i] = rng();
+
+        size_t cover_size;
+        unsigned char *cover = make_cover(dc, &cover_size);
+        char cover_fname[64], secret_fname[64], stego_fname[64], arg[8] = "";
+        snprintf(cover_fname, sizeof(cover_fname), "cover%d.bmp", id);
+        snprintf(secret_fname, sizeof(secret_fname), "secret%d%s", id, dc->extn);
+        snprintf(stego_fname, sizeof(stego_fname), "stego%d.bmp", id);
+        if (cover == NULL || write_file(cover_fname, cover, cover_size) != 0 ||
+            write_file(secret_fname, dc->secret, dc->secret_size) != 0)
+            return 2;
+
+        // 1. Encode, and compare with the scalar reference
+        mask_arg(dc->mask, arg);
+        snprintf(cmd, sizeof(cmd), "'%s' -e %s %s %s%s%s%s >/dev/null 2>&1", steg, cover_fname, secret_fname,
+                 stego_fname, dc->mask && !(dc->adaptive && dc->mask == 0x7) ? " -m " : "",
+                 dc->mask && !(dc->adaptive && dc->mask == 0x7) ? arg : "", dc->adaptive ? " --adaptive" : "");
+        if (run(cmd) != 0)
+        {
+            // Adaptive capacity depends on the texture, which is random
+            if (dc->adaptive)
+                skipped++;
+            else
+                report(id, dc, "encoding failed");
+            free(cover);
+            continue;
+        }
+        dc->encoded = 1;
+        if (!dc->adaptive)
+        {
+            reference_encode(dc, cover);
+            check_file(id, dc, stego_fname, cover, cover_size, "stego image");
+        }
+        free(cover);
+
+        // 2. Decode from the file, a pipe (stdin when it must seek), and through the cache twice
+        char out[64];
+        snprintf(cmd, sizeof(cmd), "'%s' -d %s plain%d.out >/dev/null 2>&1", steg, stego_fname, id);
+        run(cmd);
+        snprintf(out, sizeof(out), "plain%d%s", id, dc->extn);
+        check_file(id, dc, out, dc->secret, dc->secret_size, "file decode");
+
+        if (dc->adaptive)
+            snprintf(cmd, sizeof(cmd), "'%s' -d - - < %s > stream%d 2>/dev/null", steg, stego_fname, id);
+        else
+            snprintf(cmd, sizeof(cmd), "cat %s | '%s' -d - - > stream%d 2>/dev/null", stego_fname, steg, id);
+        run(cmd);
+        snprintf(out, sizeof(out), "stream%d", id);
+        check_file(id, dc, out, dc->secret, dc->secret_size, "stream decode");
+
+        for (int pass = 0; pass < 2; pass++)
+        {
+            snprintf(cmd, sizeof(cmd), "'%s' -d %s cache%d_%d.out --cache >/dev/null 2>&1", steg, stego_fname, id, pass);
+            run(cmd);
+            snprintf(out, sizeof(out), "cache%d_%d%s", id, pass, dc->extn);
+            check_file(id, dc, out, dc->secret, dc->secret_size, pass == 0 ? "--cache decode (building)" : "--cache decode (cached)");
+        }
+
+        // 3. Analysis and comparison reports
+        check_quality(id, dc, steg, cover_fname, stego_fname);
+        if (compare_builds)
+        {
+            char args[160];
+            snprintf(args, sizeof(args), "-a %s", cover_fname);
+            check_same_report(id, dc, steg, steg_scalar, args, "Analysed", "-a of the cover");
+            snprintf(args, sizeof(args), "-a %s", stego_fname);
+            check_same_report(id, dc, steg, steg_scalar, args, "Analysed", "-a of the stego image");
+            snprintf(args, sizeof(args), "-q %s %s", cover_fname, stego_fname);
+            check_same_report(id, dc, steg, steg_scalar, args, "\"seconds\"", "-q");
+        }
+
+        // 4. Update in place to a new secret; masked and adaptive images must be refused as they are
+        size_t stego_size;
+        unsigned char *stego = read_file(stego_fname, &stego_size);
+        char updated_fname[64];
+        snprintf(updated_fname, sizeof(updated_fname), "updated%d.bmp", id);
+        if (stego == NULL || write_file(updated_fname, stego, stego_size) != 0)
+            return 2;
+
+        DiffCase update = *dc;
+        update.extn = extns[rng() % 5];
+        if (dc->mask == 0 && max_secret_size(&update) > 0)
+        {
+            update.secret_size = 1 + rng() % max_secret_size(&update);
+            update.secret = malloc(update.secret_size);
+            if (update.secret == NULL)
+                return 2;
+            for (unsigned i = 0; i < update.secret_size; i++)
+                update.secret[i] = rng();
+            char update_fname[64];
+            snprintf(update_fname, sizeof(update_fname), "update%d%s", id, update.extn);
+            if (write_file(update_fname, update.secret, update.secret_size) != 0)
+                return 2;
+
+            snprintf(cmd, sizeof(cmd), "'%s' -u %s %s >/dev/null 2>&1", steg, updated_fname, update_fname);
+            if (run(cmd) != 0)
+                report(id, &update, "-u failed");
+            reference_encode(&update, stego);
+            check_file(id, &update, updated_fname, stego, stego_size, "-u image");
+
+            snprintf(cmd, sizeof(cmd), "'%s' -d %s updated%d.out >/dev/null 2>&1", steg, updated_fname, id);
+            run(cmd);
+            snprintf(out, sizeof(out), "updated%d%s", id, update.extn);
+            check_file(id, &update, out, update.secret, update.secret_size, "-u decode");
+            free(update.secret);
+        }
+        else if (dc->mask != 0)
+        {
+            snprintf(cmd, sizeof(cmd), "'%s' -u %s %s >/dev/null 2>&1", steg, updated_fname, secret_fname);
+            checks++;
+            if (run(cmd) == 0)
+                report(id, dc, "-u accepted a masked or adaptive image");
+            check_file(id, dc, updated_fname, stego, stego_size, "refused -u image");
+        }
+        free(stego);
+
+        fprintf(jobs, "d %s batch%d.out\n", stego_fname, id);
+    }
+    fclose(jobs);
+
+    // 5. Every image again in one batch, on the worker pool with group sync
+    snprintf(cmd, sizeof(cmd), "'%s' -b jobs.txt --sync group >/dev/null 2>&1", steg);
+    run(cmd);
+    for (int id = 0; id < ncases; id++)
+    {
+        if (!cases[id].encoded)
+            continue;
+        char out[64];
+        snprintf(out, sizeof(out), "batch%d%s", id, cases[id].extn);
+        check_file(id, &cases[id], out, cases[id].secret, cases[id].secret_size, "-b decode");
+    }
+
+    printf("Cases: %d, checks: %d, failed: %d, adaptive cases without room: %d (seed %llu)\n",
+           ncases, checks, failures, skipped, seed);
+    for (int id = 0; id < ncases; id++)
+        free(cases[id].secret);
+    free(cases);
+
+    if (failures > 0)
+    {
+        printf("Work directory kept: %s\n", dir);
+        return 1;
+    }
+    if (chdir("/") == 0)
+    {
+        snprintf(cmd, sizeof(cmd), "rm -rf '%s'", dir);
+        run(cmd);
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+/* Fuzz target for the decode pipeline
+ * Description: Each input is taken as a whole stego image and decoded
+ * from memory (fmemopen()), once as a single file (magic string, extn
+ * word with channel mask and adaptive threshold, extension, size, data)
+ * and once as an archive (directory table, then every entry). Outputs
+ * go to a temporary directory, under fixed names, removed at exit.
+ *
+ * libFuzzer:
+ *   clang -g -O1 -fsanitize=fuzzer,address,undefined -I. fuzz/decode_fuzz.c \
+ *       $(ls *.c | grep -v main.c) -o decode_fuzz -pthread -lm
+ *   ./decode_fuzz -close_fd_mask=2 corpus/
+ *
+ * Without libFuzzer (gcc, AFL), DECODE_FUZZ_MAIN adds a main() that
+ * runs every file named on the command line once:
+ *   gcc -g -O1 -fsanitize=address,undefined -DDECODE_FUZZ_MAIN -I. \
+ *       fuzz/decode_fuzz.c $(ls *.c | grep -v main.c) -o decode_fuzz -pthread -lm
+ */
+#define _GNU_SOURCE // fmemopen()
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "decode.h"
+#include "archive.h"
+#include "output.h"
+
+/* Names of the decoded outputs, in a directory of our own */
+static char work_dir[] = "/tmp/decode_fuzz.XXXXXX";
+static char decoded_fname[100];
+static char extracted_fname[100];
+
+/* Remove the directory and whatever the decoder left in it
+ * Description: Every extension the decoder swapped in gives another
+ * decoded.* file, so the directory is listed rather than named.
+ */
+static void remove_work_dir(void)
+{
+    DIR *dir = opendir(work_dir);
+    if (dir == NULL)
+        return;
+
+    struct dirent *entry;
+    char fname[sizeof(work_dir) + 256 + 1];
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        snprintf(fname, sizeof(fname), "%s/%s", work_dir, entry->d_name);
+        unlink(fname);
+    }
+    closedir(dir);
+    rmdir(work_dir);
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    (void)argc;
+    (void)argv;
+
+    if (mkdtemp(work_dir) == NULL)
+    {
+        perror("decode_fuzz: temporary directory");
+        exit(1);
+    }
+    atexit(remove_work_dir);
+    // The decoder swaps the last extension for the decoded one
+    snprintf(decoded_fname, sizeof(decoded_fname), "%s/decoded.out", work_dir);
+    snprintf(extracted_fname, sizeof(extracted_fname), "%s/extracted", work_dir);
+
+    // The logs would only slow the fuzzer down
+    if (freopen("/dev/null", "w", stdout) == NULL)
+        exit(1);
+    set_output_options(sync_none, 0);
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    // 1. Single secret file, as ./steg -d image.bmp decoded.out
+    DecodeInfo decInfo = {0};
+    decInfo.src_image_fname = "fuzz.bmp";
+    snprintf(decInfo.secret_fname, sizeof(decInfo.secret_fname), "%s", decoded_fname);
+    decInfo.fptr_src_image = fmemopen((void *)data, size, "r");
+    if (decInfo.fptr_src_image != NULL)
+        do_decoding(&decInfo);
+    close_decode_files(&decInfo);
+
+    // 2. Several files, as ./steg -d image.bmp --extract, all to one name
+    ArchiveInfo arcInfo = {0};
+    arcInfo.src_image_fname = "fuzz.bmp";
+    arcInfo.output_fname = extracted_fname;
+    arcInfo.fptr_src_image = fmemopen((void *)data, size, "r");
+    if (arcInfo.fptr_src_image != NULL)
+        do_archive_extract(&arcInfo);
+    free_archive(&arcInfo);
+    return 0;
+}
+
+#ifdef DECODE_FUZZ_MAIN
+
+int main(int argc, char *argv[])
+{
+    LLVMFuzzerInitialize(&argc, &argv);
+    for (int i = 1; i < argc; i++)
+    {
+        FILE *fptr = fopen(argv[i], "r");
+        if (fptr == NULL)
+        {
+            perror(argv[i]);
+            continue;
+        }
+
+        size_t capacity = 1 << 16, size = 0, n;
+        uint8_t *data = malloc(capacity);
+        while (data != NULL && (n = fread(data + size, 1, capacity - size, fptr)) > 0)
+        {
+            size += n;
+            if (size == capacity)
+            {
+                uint8_t *grown = realloc(data, capacity *= 2);
+                if (grown == NULL)
+                    free(data);
+                data = grown;
+            }
+        }
+        fclose(fptr);
+
+        if (data != NULL)
+            LLVMFuzzerTestOneInput(data, size);
+        free(data);
+    }
+    return 0;
+}
+
+#endif
@@ -19,16 +19,37 @@ Description: This project is a console-based LSB Image Steganography application
 #include "types.h"
 #include "encode.h"
 #include "decode.h"
+#include "analyze.h"
+#include "archive.h"
+#include "update.h"
+#include "quality.h"
+#include "batch.h"
+#include "watch.h"
+#include "output.h"
+#include "cache.h"
+#include "stream.h"
 #include "colour.h"
 
 /* Function Declarations */
 OperationType check_operation_type(char *argv[]);
+char *take_option(int *argc, char *argv[], const char *name);
+int take_flag(int *argc, char *argv[], const char *name);
+int is_archive_encoding(int argc, char *argv[]);
+int run_archive_encoding(int argc, char *argv[]);
+int run_archive_decoding(int argc, char *argv[]);
 void print_usage();
 
 /* Main function */
 int main(int argc, char *argv[])
 {
-    if (argc > 5 || argc < 3)
+    // Options are taken out first so the positional arguments stay in place
+    char *mask_arg = take_option(&argc, argv, "-m");
+    int adaptive = take_flag(&argc, argv, "--adaptive");
+    char *sync_arg = take_option(&argc, argv, "--sync");
+    int direct = take_flag(&argc, argv, "--direct");
+    int cache = take_flag(&argc, argv, "--cache");
+
+    if (argc < 3)
     {
         print_usage();
         return 1;
@@ -36,23 +57,48 @@ int main(int argc, char *argv[])
 
     OperationType op_type = check_operation_type(argv);
 
+    SyncMode sync = sync_none;
+    if (sync_arg != NULL && parse_sync_mode(sync_arg, &sync) == failure)
+        return 1;
+    // A single output has nothing to share a group sync with
+    if (sync == sync_group && op_type != batch && op_type != watch)
+        sync = sync_file;
+    set_output_options(sync, direct);
+    set_image_cache(cache);
+
     if (op_type == encode)
     {
         if(argc < 4){
             print_usage();
             return 1;
         }
+        // More than one secret file: embed them all with a directory table
+        if (is_archive_encoding(argc, argv))
+        {
+            if (mask_arg != NULL || adaptive)
+            {
+                printf(RED"ERROR: Channel masks and adaptive mode are not supported with several files.\n"RESET);
+                return 1;
+            }
+            return run_archive_encoding(argc, argv);
+        }
+        // Stego image goes to stdout, so keep the logs off it from the start
+        if (argc == 5 && is_stream_fname(argv[4]) && open_stdout_stream() == NULL)
+            return 1;
         printf(CYAN BOLD"Selected operation: Encoding\n"RESET);
 
-        EncodeInfo encInfo;
-        if (read_and_validate_encode_args(argv, &encInfo) == failure)
+        EncodeInfo encInfo = {0};
+        if (read_and_validate_encode_args(argv, &encInfo) == failure ||
+            (mask_arg != NULL && parse_channel_mask(mask_arg, &encInfo.channel_mask) == failure))
         {
             printf(RED"ERROR: Invalid encoding arguments.\n"RESET);
             return 1;
         }
+        encInfo.adaptive = adaptive;
 
         if (do_encoding(&encInfo) == failure)
         {
+            close_encode_files(&encInfo); // Also removes the unfinished stego image
             printf(RED"ERROR: Encoding failed.\n"RESET);
             return 1;
         }
@@ -61,9 +107,20 @@ int main(int argc, char *argv[])
     }
     else if (op_type == decode)
     {
+        // --list / --extract work on images holding several files
+        if (argc >= 4 && strncmp(argv[3], "--", 2) == 0)
+            return run_archive_decoding(argc, argv);
+        if (argc > 4)
+        {
+            print_usage();
+            return 1;
+        }
+        // Secret goes to stdout, so keep the logs off it from the start
+        if (argc == 4 && is_stream_fname(argv[3]) && open_stdout_stream() == NULL)
+            return 1;
         printf(CYAN BOLD"Selected operation: Decoding\n"RESET);
 
-        DecodeInfo decInfo;
+        DecodeInfo decInfo = {0};
         if (read_and_validate_decode_args(argv, &decInfo) == failure)
         {
             printf(RED"ERROR: Invalid decoding arguments.\n"RESET);
@@ -72,12 +129,147 @@ int main(int argc, char *argv[])
 
         if (do_decoding(&decInfo) == failure)
         {
+            close_decode_files(&decInfo); // Also removes the unfinished secret file
             printf(RED"ERROR: Decoding failed.\n"RESET);
             return 1;
         }
 
         printf(GREEN BOLD"Decoding successful!\n\n"RESET);
     }
+    else if (op_type == update)
+    {
+        if (argc != 4)
+        {
+            print_usage();
+            return 1;
+        }
+        // The update reuses the layout of the embedded payload, it can't change it
+        if (mask_arg != NULL || adaptive)
+        {
+            printf(RED"ERROR: -m and --adaptive can't be used with -u, re-encode the image instead.\n"RESET);
+            return 1;
+        }
+        printf(CYAN BOLD"Selected operation: In-place update\n"RESET);
+
+        EncodeInfo encInfo = {0};
+        UpdateStats stats = {0};
+        if (read_and_validate_encode_args(argv, &encInfo) == failure)
+        {
+            printf(RED"ERROR: Invalid update arguments.\n"RESET);
+            return 1;
+        }
+
+        if (do_update(&encInfo, &stats) == failure)
+        {
+            printf(RED"ERROR: Update failed.\n"RESET);
+            return 1;
+        }
+
+        printf(GREEN BOLD"Update successful!\n\n"RESET);
+    }
+    else if (op_type == quality)
+    {
+        if (argc != 4)
+        {
+            print_usage();
+            return 1;
+        }
+        // stdout carries only the JSON, logs go to stderr
+        FILE *fptr_json = open_stdout_stream();
+        if (fptr_json == NULL)
+            return 1;
+        printf(CYAN BOLD"Selected operation: Quality comparison\n"RESET);
+
+        QualityInfo qInfo = {0};
+        if (read_and_validate_quality_args(argv, &qInfo) == failure)
+        {
+            printf(RED"ERROR: Invalid comparison arguments.\n"RESET);
+            return 1;
+        }
+
+        if (do_quality(&qInfo) == failure)
+        {
+            printf(RED"ERROR: Comparison failed.\n"RESET);
+            return 1;
+        }
+
+        write_quality_json(&qInfo, fptr_json);
+        if (fclose(fptr_json) != 0)
+            return 1;
+        printf(GREEN BOLD"Comparison done!\n\n"RESET);
+    }
+    else if (op_type == analyze)
+    {
+        printf(CYAN BOLD"Selected operation: Analysis\n"RESET);
+
+        static AnalyzeInfo anInfo; // Large histograms, keep off the stack
+        if (read_and_validate_analyze_args(argv, &anInfo) == failure)
+        {
+            printf(RED"ERROR: Invalid analysis arguments.\n"RESET);
+            return 1;
+        }
+
+        if (do_analysis(&anInfo) == failure)
+        {
+            printf(RED"ERROR: Analysis failed.\n"RESET);
+            return 1;
+        }
+
+        printf(GREEN BOLD"Analysis done!\n\n"RESET);
+    }
+    else if (op_type == batch)
+    {
+        if (argc != 3)
+        {
+            print_usage();
+            return 1;
+        }
+        // Per-job logs from many threads would interleave, keep only the report
+        FILE *fptr_report = open_quiet_stdout();
+        if (fptr_report == NULL)
+            return 1;
+        fprintf(fptr_report, CYAN BOLD"Selected operation: Batch\n"RESET);
+
+        BatchInfo batchInfo = {0};
+        batchInfo.manifest_fname = argv[2];
+        batchInfo.fptr_report = fptr_report;
+        if (read_batch_manifest(&batchInfo) == failure)
+        {
+            fprintf(fptr_report, RED"ERROR: Invalid batch manifest.\n"RESET);
+            return 1;
+        }
+
+        Status status = do_batch(&batchInfo);
+        free_batch(&batchInfo);
+        if (status == failure)
+        {
+            fprintf(fptr_report, RED"ERROR: Some batch jobs failed.\n"RESET);
+            return 1;
+        }
+        fprintf(fptr_report, GREEN BOLD"Batch successful!\n\n"RESET);
+    }
+    else if (op_type == watch)
+    {
+        WatchInfo watchInfo = {0};
+        if (read_and_validate_watch_args(argc, argv, &watchInfo) == failure)
+        {
+            print_usage();
+            return 1;
+        }
+        // Per-job logs from many threads would interleave, keep only the report
+        FILE *fptr_report = open_quiet_stdout();
+        if (fptr_report == NULL)
+            return 1;
+        fprintf(fptr_report, CYAN BOLD"Selected operation: Watch\n"RESET);
+        watchInfo.fptr_report = fptr_report;
+
+        if (do_watch(&watchInfo) == failure)
+        {
+            fprintf(fptr_report, RED"ERROR: Watch failed.\n"RESET);
+            return 1;
+        }
+        fprintf(fptr_report, GREEN BOLD"Watch stopped.\n\n"RESET);
+    }
     else
     {
         printf(RED BOLD"ERROR: Unsupported operation.\n"RESET);
@@ -88,13 +280,129 @@ int main(int argc, char *argv[])
     return 0;
 }
 
-/* Identify encode/decode from argv[1] */
+/* Remove "name value" from argv and return value (NULL if not given) */
+char *take_option(int *argc, char *argv[], const char *name)
+{
+    for (int i = 2; i < *argc - 1; i++)
+    {
+        if (strcmp(argv[i], name) != 0)
+            continue;
+
+        char *value = argv[i + 1];
+        for (int j = i; j + 2 <= *argc; j++)
+            argv[j] = argv[j + 2];
+        *argc -= 2;
+        return value;
+    }
+    return NULL;
+}
+
+/* Remove a flag from argv and return whether it was given */
+int take_flag(int *argc, char *argv[], const char *name)
+{
+    for (int i = 2; i < *argc; i++)
+    {
+        if (strcmp(argv[i], name) != 0)
+            continue;
+
+        for (int j = i; j + 1 <= *argc; j++)
+            argv[j] = argv[j + 1];
+        *argc -= 1;
+        return 1;
+    }
+    return 0;
+}
+
+/* Check whether the encode arguments hold more than one secret file */
+int is_archive_encoding(int argc, char *argv[])
+{
+    if (argc > 5)
+        return 1;
+    if (argc < 5 || is_stream_fname(argv[4]))
+        return 0;
+
+    char *dot = strrchr(argv[4], '.');
+    return dot == NULL || strcmp(dot, ".bmp") != 0;
+}
+
+/* Encode several files into one image */
+int run_archive_encoding(int argc, char *argv[])
+{
+    // Stego image goes to stdout, so keep the logs off it from the start
+    if (is_stream_fname(argv[argc - 1]) && open_stdout_stream() == NULL)
+        return 1;
+    printf(CYAN BOLD"Selected operation: Archive encoding\n"RESET);
+
+    ArchiveInfo arcInfo = {0};
+    if (read_and_validate_archive_args(argc, argv, &arcInfo) == failure)
+    {
+        printf(RED"ERROR: Invalid encoding arguments.\n"RESET);
+        free_archive(&arcInfo);
+        return 1;
+    }
+
+    if (do_archive_encoding(&arcInfo) == failure)
+    {
+        printf(RED"ERROR: Encoding failed.\n"RESET);
+        free_archive(&arcInfo);
+        return 1;
+    }
+
+    free_archive(&arcInfo);
+    printf(GREEN BOLD"Encoding successful!\n\n"RESET);
+    return 0;
+}
+
+/* List or extract files of an image holding several files */
+int run_archive_decoding(int argc, char *argv[])
+{
+    // Extracted file goes to stdout, so keep the logs off it from the start
+    if (argc == 6 && is_stream_fname(argv[5]) && open_stdout_stream() == NULL)
+        return 1;
+    printf(CYAN BOLD"Selected operation: Archive decoding\n"RESET);
+
+    ArchiveInfo arcInfo = {0};
+    if (read_and_validate_archive_decode_args(argc, argv, &arcInfo) == failure)
+    {
+        printf(RED"ERROR: Invalid decoding arguments.\n"RESET);
+        print_usage();
+        return 1;
+    }
+
+    Status status;
+    if (strcmp(argv[3], "--list") == 0)
+        status = do_archive_list(&arcInfo);
+    else
+        status = do_archive_extract(&arcInfo);
+    free_archive(&arcInfo);
+
+    if (status == failure)
+    {
+        printf(RED"ERROR: Decoding failed.\n"RESET);
+        return 1;
+    }
+
+    printf(GREEN BOLD"Decoding successful!\n\n"RESET);
+    return 0;
+}
+
+/* Identify the operation from argv[1] */
 OperationType check_operation_type(char *argv[])
 {
     if (strcmp(argv[1], "-e") == 0)
         return encode;
     else if (strcmp(argv[1], "-d") == 0)
         return decode;
+    else if (strcmp(argv[1], "-a") == 0)
+        return analyze;
+    else if (strcmp(argv[1], "-u") == 0)
+        return update;
+    else if (strcmp(argv[1], "-q") == 0)
+        return quality;
+    else if (strcmp(argv[1], "-b") == 0)
+        return batch;
+    else if (strcmp(argv[1], "--watch") == 0)
+        return watch;
     else
         return unsupported;
 }
@@ -104,7 +412,22 @@ void print_usage()
 {
     printf(YELLOW"-------------------------------------------------------------\n");
     printf("Usage:\n");
-    printf("  Encoding: ./steg.exe -e <source.bmp> <secret.txt> [output.bmp]\n");
-    printf("  Decoding: ./steg.exe -d <stego.bmp> [output.txt]\n");
+    printf("  Encoding: ./steg -e <source.bmp> <secret.txt> [output.bmp]\n");
+    printf("            add -m <channels> to embed only in some channels, e.g. -m b, -m bg, -m bgr\n");
+    printf("            add --adaptive to embed only in textured (edge) regions\n");
+    printf("  Decoding: ./steg -d <stego.bmp> [output.txt]\n");
+    printf("  Update:   ./steg -u <stego.bmp> <secret.txt>\n");
+    printf("  Archive:  ./steg -e <source.bmp> <file1> <file2>... [output.bmp]\n");
+    printf("            ./steg -d <stego.bmp> --list\n");
+    printf("            ./steg -d <stego.bmp> --extract [NAME [output]]\n");
+    printf("  Analysis: ./steg -a <image.bmp>\n");
+    printf("  Quality:  ./steg -q <cover.bmp> <stego.bmp>   (JSON on stdout)\n");
+    printf("  Batch:    ./steg -b <manifest>   (lines: e <source.bmp> <secret> [output.bmp] | d <stego.bmp> [output])\n");
+    printf("  Watch:    ./steg --watch -e <cover_dir> <secret_dir> <out_dir>\n");
+    printf("            ./steg --watch -d <stego_dir> <out_dir>\n");
+    printf("  Output:   add --sync none|file|group to choose durability (group: batch/watch)\n");
+    printf("            add --direct to write outputs with O_DIRECT, bypassing the page cache\n");
+    printf("  Cache:    add --cache when decoding/extracting to read a packed LSB sidecar (<image>.lsbc)\n");
+    printf("  Streaming: use - for <source.bmp>/<stego.bmp> (stdin) or the output (stdout)\n");
     printf("-------------------------------------------------------------\n"RESET);
 }
\ No newline at end of file
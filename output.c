@@ -0,0 +1,588 @@
+#define _GNU_SOURCE // fopencookie(), O_DIRECT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "output.h"
+#include "stream.h"
+#include "colour.h"
+
+/* Options for every output, set once from main() */
+static SyncMode output_sync = sync_none;
+static int output_direct = 0;
+static mode_t output_umask = 022;
+
+/* An output written and closed, waiting for the next group sync */
+typedef struct _GroupOutput
+{
+    char *tmp_fname;
+    char *fname;
+    int fd;        // Still open for fdatasync()
+    dev_t dir_dev; // Directory holding both names
+    ino_t dir_ino;
+} GroupOutput;
+
+static pthread_mutex_t group_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t group_cond = PTHREAD_COND_INITIALIZER; // Signalled when the group is emptied
+static GroupOutput group[OUTPUT_GROUP_SIZE];
+static int group_count = 0;
+
+/* The group being synced, still visible (under group_lock) until renamed.
+ * flush_lock is held for the whole sync, so there is at most one.
+ */
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+static GroupOutput flushing[OUTPUT_GROUP_SIZE];
+static int flushing_count = 0;
+
+/* Function Definitions */
+
+/* Parse "none", "file" or "group" */
+Status parse_sync_mode(const char *arg, SyncMode *mode)
+{
+    if (strcmp(arg, "none") == 0)
+        *mode = sync_none;
+    else if (strcmp(arg, "file") == 0)
+        *mode = sync_file;
+    else if (strcmp(arg, "group") == 0)
+        *mode = sync_group;
+    else
+    {
+        printf(RED"ERROR: Invalid sync mode '%s', use none, file or group\n"RESET, arg);
+        return failure;
+    }
+    return success;
+}
+
+/* Set the durability level and O_DIRECT use for every output */
+void set_output_options(SyncMode mode, int direct)
+{
+    output_sync = mode;
+    output_direct = direct;
+
+    // umask() can only be read by setting it, so do it once before any thread starts
+    output_umask = umask(0);
+    umask(output_umask);
+}
+
+// Last path component of fname
+static const char *output_basename(const char *fname)
+{
+    const char *slash = strrchr(fname, '/');
+    return slash != NULL ? slash + 1 : fname;
+}
+
+// Open the directory holding fname
+static int open_parent_directory(const char *fname)
+{
+    const char *base = output_basename(fname);
+    char *dir = base != fname ? strndup(fname, base - fname) : strdup(".");
+    if (dir == NULL)
+        return -1;
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    free(dir);
+    return fd;
+}
+
+#ifdef __linux__
+
+/* Buffer between stdio and an O_DIRECT descriptor */
+typedef struct _DirectWriter
+{
+    int fd;
+    char *buffer;  // DIRECT_ALIGN aligned
+    size_t fill;
+    int buffered;  // O_DIRECT was refused, writing through the page cache
+} DirectWriter;
+
+// Take O_DIRECT off the descriptor
+static Status clear_direct(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags & ~O_DIRECT) == 0 ? success : failure;
+}
+
+/* write() all of len, retrying short writes
+ * Description: Some filesystems accept O_DIRECT in fcntl() and refuse
+ * the writes themselves with EINVAL (tmpfs, a block size above
+ * DIRECT_ALIGN); the rest of the file then goes through the page cache.
+ */
+static Status write_all(DirectWriter *dw, const char *data, size_t len)
+{
+    static int warned = 0;
+    while (len > 0)
+    {
+        ssize_t n = write(dw->fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EINVAL && !dw->buffered)
+        {
+            if (clear_direct(dw->fd) == failure)
+                return failure;
+            if (!warned)
+                fprintf(stderr, YELLOW"WARNING: O_DIRECT write refused by the filesystem, using the page cache\n"RESET);
+            warned = 1;
+            dw->buffered = 1;
+            continue;
+        }
+        if (n <= 0)
+            return failure;
+        data += n;
+        len -= n;
+    }
+    return success;
+}
+
+// Gather data and write it out in whole aligned buffers
+static ssize_t direct_write(void *cookie, const char *data, size_t size)
+{
+    DirectWriter *dw = cookie;
+    size_t done = 0;
+    while (done < size)
+    {
+        size_t n = size - done;
+        if (n > DIRECT_BUFFER_SIZE - dw->fill)
+            n = DIRECT_BUFFER_SIZE - dw->fill;
+        memcpy(dw->buffer + dw->fill, data + done, n);
+        dw->fill += n;
+        done += n;
+
+        if (dw->fill == DIRECT_BUFFER_SIZE)
+        {
+            if (write_all(dw, dw->buffer, DIRECT_BUFFER_SIZE) == failure)
+                return -1;
+            dw->fill = 0;
+        }
+    }
+    return size;
+}
+
+// Write what is left; a tail shorter than a block cannot go through O_DIRECT
+static int direct_close(void *cookie)
+{
+    DirectWriter *dw = cookie;
+    int status = 0;
+    size_t aligned = dw->fill / DIRECT_ALIGN * DIRECT_ALIGN;
+
+    if (aligned > 0 && write_all(dw, dw->buffer, aligned) == failure)
+        status = -1;
+    if (status == 0 && dw->fill > aligned)
+    {
+        if (!dw->buffered && clear_direct(dw->fd) == failure)
+            status = -1;
+        dw->buffered = 1;
+        if (status == 0 && write_all(dw, dw->buffer + aligned, dw->fill - aligned) == failure)
+            status = -1;
+    }
+
+    // The descriptor stays open for commit_output()
+    free(dw->buffer);
+    free(dw);
+    return status;
+}
+
+// Switch the temporary file to O_DIRECT; NULL if the filesystem does not allow it
+static FILE *open_direct(OutputFile *out)
+{
+    static int warned = 0;
+    int flags = fcntl(out->fd, F_GETFL);
+    if (flags < 0 || fcntl(out->fd, F_SETFL, flags | O_DIRECT) < 0)
+    {
+        if (!warned)
+            fprintf(stderr, YELLOW"WARNING: O_DIRECT is not supported for %s, using the page cache\n"RESET, out->fname);
+        warned = 1;
+        return NULL;
+    }
+
+    DirectWriter *dw = malloc(sizeof(DirectWriter));
+    void *buffer = NULL;
+    if (dw == NULL || posix_memalign(&buffer, DIRECT_ALIGN, DIRECT_BUFFER_SIZE) != 0)
+    {
+        free(dw);
+        fcntl(out->fd, F_SETFL, flags);
+        return NULL;
+    }
+    dw->fd = out->fd;
+    dw->buffer = buffer;
+    dw->fill = 0;
+    dw->buffered = 0;
+
+    cookie_io_functions_t io = {NULL, direct_write, NULL, direct_close};
+    FILE *fptr = fopencookie(dw, "w", io);
+    if (fptr == NULL)
+    {
+        free(buffer);
+        free(dw);
+        fcntl(out->fd, F_SETFL, flags);
+        return NULL;
+    }
+    out->direct = 1;
+    return fptr;
+}
+
+#else
+
+static FILE *open_direct(OutputFile *out)
+{
+    (void)out;
+    return NULL;
+}
+
+#endif
+
+// Temporary file next to fname, for an output or a sidecar
+static FILE *open_output_file(OutputFile *out, const char *fname, char *buffer, size_t buffer_size, int sidecar)
+{
+    memset(out, 0, sizeof(*out));
+    out->fd = -1;
+    out->sidecar = sidecar;
+    if (is_stream_fname(fname))
+    {
+        out->fptr = open_stdout_stream();
+        return out->fptr;
+    }
+
+    const char *base = output_basename(fname);
+    size_t len = strlen(fname) + 9;
+    out->fname = strdup(fname);
+    out->tmp_fname = malloc(len);
+    if (out->fname == NULL || out->tmp_fname == NULL)
+    {
+        abort_output(out);
+        return NULL;
+    }
+    snprintf(out->tmp_fname, len, "%.*s.%s.XXXXXX", (int)(base - fname), fname, base);
+
+    out->fd = mkstemp(out->tmp_fname);
+    if (out->fd < 0)
+    {
+        int saved_errno = errno;
+        free(out->tmp_fname);
+        out->tmp_fname = NULL; // Nothing to remove
+        abort_output(out);
+        errno = saved_errno;
+        return NULL;
+    }
+    // mkstemp() creates the file 0600, give it what fopen() would have
+    fchmod(out->fd, 0666 & ~output_umask);
+
+    if (output_direct && !sidecar)
+        out->fptr = open_direct(out);
+    if (out->fptr == NULL)
+        out->fptr = fdopen(out->fd, "w");
+    if (out->fptr == NULL)
+    {
+        int saved_errno = errno;
+        abort_output(out);
+        errno = saved_errno;
+        return NULL;
+    }
+    if (buffer != NULL)
+        setvbuf(out->fptr, buffer, _IOFBF, buffer_size);
+    return out->fptr;
+}
+
+/* Open a temporary file next to fname ("-" gives stdout)
+ * Description: The temporary file is "dir/.name.XXXXXX", in the same
+ * directory so the final rename() is atomic. buffer, if given, is used
+ * as the stdio buffer.
+ */
+FILE *open_output(OutputFile *out, const char *fname, char *buffer, size_t buffer_size)
+{
+    return open_output_file(out, fname, buffer, buffer_size, 0);
+}
+
+/* Open a temporary file for a sidecar next to fname
+ * Description: Like open_output(), but the sidecar is never written
+ * through O_DIRECT and commit_output() renames it straight away even
+ * under sync_group, so the next open finds it.
+ */
+FILE *open_sidecar_output(OutputFile *out, const char *fname)
+{
+    return open_output_file(out, fname, NULL, 0, 1);
+}
+
+/* Set the permissions the final file will have */
+Status chmod_output(OutputFile *out, mode_t mode)
+{
+    if (out->tmp_fname == NULL || out->fd < 0)
+        return failure;
+    return fchmod(out->fd, mode) == 0 ? success : failure;
+}
+
+// fsync() the directory holding fname so a rename in it is on disk
+static Status sync_parent_directory(const char *fname)
+{
+    int fd = open_parent_directory(fname);
+    if (fd < 0 || fsync(fd) != 0)
+    {
+        perror(RED"ERROR: Unable to sync output directory"RESET);
+        if (fd >= 0)
+            close(fd);
+        return failure;
+    }
+    close(fd);
+    return success;
+}
+
+/* Sync one group and rename it into place
+ * Description: Every file's data is synced through its own descriptor,
+ * the renames follow, and one fsync() per output directory makes the
+ * new names durable; the directory syncs are shared by the whole group
+ * instead of paid once per file.
+ */
+static Status flush_group_list(GroupOutput *list, int count)
+{
+    Status status = success;
+    for (int i = 0; i < count; i++)
+    {
+        if (status == success && fdatasync(list[i].fd) != 0)
+        {
+            perror(RED"ERROR: Unable to sync output"RESET);
+            status = failure;
+        }
+        close(list[i].fd);
+    }
+
+    int renamed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (status == success && rename(list[i].tmp_fname, list[i].fname) == 0)
+        {
+            renamed++;
+            continue;
+        }
+        if (status == success)
+            perror(RED"ERROR: Unable to move output into place"RESET);
+        status = failure;
+        unlink(list[i].tmp_fname);
+    }
+
+    // Everything renamed comes first; one sync per directory among them
+    for (int i = 0; i < renamed; i++)
+    {
+        int seen = 0;
+        for (int k = 0; k < i && !seen; k++)
+            seen = list[k].dir_dev == list[i].dir_dev && list[k].dir_ino == list[i].dir_ino;
+        if (!seen && sync_parent_directory(list[i].fname) == failure)
+            status = failure;
+    }
+    return status;
+}
+
+// Take every waiting output and sync it; called with flush_lock held
+static Status flush_waiting_group(void)
+{
+    pthread_mutex_lock(&group_lock);
+    memcpy(flushing, group, group_count * sizeof(GroupOutput));
+    flushing_count = group_count;
+    group_count = 0;
+    pthread_cond_broadcast(&group_cond);
+    pthread_mutex_unlock(&group_lock);
+
+    int count = flushing_count;
+    Status status = count > 0 ? flush_group_list(flushing, count) : success;
+
+    // Only now are the final names in place
+    pthread_mutex_lock(&group_lock);
+    flushing_count = 0;
+    pthread_mutex_unlock(&group_lock);
+    for (int i = 0; i < count; i++)
+    {
+        free(flushing[i].tmp_fname);
+        free(flushing[i].fname);
+    }
+    return status;
+}
+
+// Hand a closed temporary file and its descriptor over to the group; the last one to fill it syncs
+static Status queue_group_output(OutputFile *out)
+{
+    int dir_fd = open_parent_directory(out->fname);
+    struct stat dir;
+    if (dir_fd < 0 || fstat(dir_fd, &dir) != 0)
+    {
+        perror(RED"ERROR: Unable to sync output directory"RESET);
+        if (dir_fd >= 0)
+            close(dir_fd);
+        abort_output(out);
+        return failure;
+    }
+    close(dir_fd);
+
+    pthread_mutex_lock(&group_lock);
+    // A full group is about to be taken by the thread that filled it
+    while (group_count == OUTPUT_GROUP_SIZE)
+        pthread_cond_wait(&group_cond, &group_lock);
+    GroupOutput *entry = &group[group_count++];
+    entry->tmp_fname = out->tmp_fname;
+    entry->fname = out->fname;
+    entry->fd = out->fd;
+    entry->dir_dev = dir.st_dev;
+    entry->dir_ino = dir.st_ino;
+    int full = group_count == OUTPUT_GROUP_SIZE;
+    pthread_mutex_unlock(&group_lock);
+
+    out->tmp_fname = NULL;
+    out->fname = NULL;
+    out->fd = -1;
+    return full ? flush_output_group() : success;
+}
+
+/* Sync and rename every output waiting for a group sync */
+Status flush_output_group(void)
+{
+    pthread_mutex_lock(&flush_lock);
+    Status status = flush_waiting_group();
+    pthread_mutex_unlock(&flush_lock);
+    return status;
+}
+
+/* Put fname in place first if it is an output waiting for a group sync
+ * Description: Until its group is synced, a finished output only exists
+ * under its temporary name. A job about to read fname calls this, so
+ * it finds the new file instead of nothing or the previous one; if the
+ * group is already being synced, it waits for that sync to finish.
+ */
+Status flush_pending_output(const char *fname)
+{
+    if (output_sync != sync_group || is_stream_fname(fname))
+        return success;
+
+    int dir_fd = open_parent_directory(fname);
+    struct stat dir;
+    if (dir_fd < 0)
+        return success; // No such directory, so no output of ours in it
+    int ok = fstat(dir_fd, &dir) == 0;
+    close(dir_fd);
+    if (!ok)
+        return success;
+
+    const char *base = output_basename(fname);
+    int pending = 0, in_flight = 0;
+    pthread_mutex_lock(&group_lock);
+    for (int i = 0; i < group_count && !pending; i++)
+        pending = group[i].dir_dev == dir.st_dev && group[i].dir_ino == dir.st_ino &&
+                  strcmp(output_basename(group[i].fname), base) == 0;
+    for (int i = 0; i < flushing_count && !in_flight; i++)
+        in_flight = flushing[i].dir_dev == dir.st_dev && flushing[i].dir_ino == dir.st_ino &&
+                    strcmp(output_basename(flushing[i].fname), base) == 0;
+    pthread_mutex_unlock(&group_lock);
+
+    if (pending)
+        return flush_output_group();
+    if (in_flight)
+    {
+        // Being synced by another thread; it is in place once that sync lets go
+        pthread_mutex_lock(&flush_lock);
+        pthread_mutex_unlock(&flush_lock);
+    }
+    return success;
+}
+
+/* Finish the output: flush, sync and rename it into place
+ * Description: Until this returns, the final name still holds whatever
+ * was there before (or nothing), never a partial file. With sync_group
+ * the rename waits for the next group sync.
+ */
+Status commit_output(OutputFile *out)
+{
+    if (out->fptr == NULL)
+        return failure;
+
+    // A sidecar can't wait for the group, it is read right after
+    SyncMode sync = output_sync;
+    if (out->sidecar && sync == sync_group)
+        sync = sync_file;
+
+    // stdout: nothing to rename
+    if (out->tmp_fname == NULL)
+    {
+        int ok = fflush(out->fptr) == 0;
+        out->fptr = NULL;
+        return ok ? success : failure;
+    }
+
+    // 1. Everything buffered goes to the temporary file; the descriptor
+    // outlives fclose() for the sync (a DirectWriter leaves it open)
+    int fd = out->direct ? out->fd : dup(out->fd);
+    int ok = fclose(out->fptr) == 0 && fd >= 0;
+    out->fptr = NULL;
+    out->fd = fd;
+    if (ok && sync == sync_file)
+        ok = fdatasync(out->fd) == 0;
+    if (!ok)
+    {
+        perror(RED"ERROR: Unable to write output file"RESET);
+        abort_output(out);
+        return failure;
+    }
+
+    // 2. Replace the final name in one step; the group keeps the descriptor
+    if (sync == sync_group)
+        return queue_group_output(out);
+    close(out->fd);
+    out->fd = -1;
+    if (rename(out->tmp_fname, out->fname) != 0)
+    {
+        perror(RED"ERROR: Unable to move output into place"RESET);
+        abort_output(out);
+        return failure;
+    }
+
+    Status status = success;
+    if (sync == sync_file)
+        status = sync_parent_directory(out->fname);
+    free(out->tmp_fname);
+    free(out->fname);
+    out->tmp_fname = NULL;
+    out->fname = NULL;
+    return status;
+}
+
+/* Flush a file changed in place and sync it as --sync asks
+ * Description: For files rewritten where they are (-u), which never go
+ * through a temporary name. There is no group to wait for, so
+ * sync_group syncs right away like sync_file.
+ */
+Status sync_in_place(FILE *fptr)
+{
+    if (fflush(fptr) != 0)
+        return failure;
+    if (output_sync != sync_none && fdatasync(fileno(fptr)) != 0)
+        return failure;
+    return success;
+}
+
+/* Drop an unfinished output; does nothing once committed */
+void abort_output(OutputFile *out)
+{
+    if (out->fptr != NULL)
+    {
+        if (out->tmp_fname == NULL)
+            fflush(out->fptr); // stdout stays open
+        else
+        {
+            fclose(out->fptr);
+            if (!out->direct)
+                out->fd = -1;
+        }
+    }
+    if (out->tmp_fname != NULL)
+    {
+        if (out->fd >= 0)
+            close(out->fd);
+        unlink(out->tmp_fname);
+    }
+
+    free(out->tmp_fname);
+    free(out->fname);
+    out->tmp_fname = NULL;
+    out->fname = NULL;
+    out->fptr = NULL;
+    out->fd = -1;
+}
@@ -0,0 +1,69 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "types.h" // Contains user defined types
+
+/* Outputs renamed into place per group sync */
+#define OUTPUT_GROUP_SIZE 64
+
+/* Alignment and size of the O_DIRECT write buffer */
+#define DIRECT_ALIGN 4096
+#define DIRECT_BUFFER_SIZE (256 * DIRECT_ALIGN)
+
+/* How hard to push finished outputs to disk */
+typedef enum
+{
+    sync_none,  // Leave it to the kernel
+    sync_file,  // fdatasync() every output and its directory
+    sync_group  // Renames and directory syncs shared by a group of outputs (batch and watch jobs)
+} SyncMode;
+
+/*
+ * An output file being written: the data goes to a temporary file in
+ * the same directory, which replaces the final name only once complete
+ */
+typedef struct _OutputFile
+{
+    char *fname;     // Final name
+    char *tmp_fname; // Temporary name, NULL when writing to stdout
+    FILE *fptr;      // Where the data is written
+    int fd;          // Descriptor of the temporary file
+    int direct;      // Written through O_DIRECT
+    int sidecar;     // Cache file: committed on its own, never O_DIRECT
+} OutputFile;
+
+/* Output function prototypes */
+
+/* Parse "none", "file" or "group" */
+Status parse_sync_mode(const char *arg, SyncMode *mode);
+
+/* Set the durability level and O_DIRECT use for every output */
+void set_output_options(SyncMode mode, int direct);
+
+/* Open a temporary file next to fname ("-" gives stdout) */
+FILE *open_output(OutputFile *out, const char *fname, char *buffer, size_t buffer_size);
+
+/* Open a temporary file for a sidecar next to fname */
+FILE *open_sidecar_output(OutputFile *out, const char *fname);
+
+/* Set the permissions the final file will have */
+Status chmod_output(OutputFile *out, mode_t mode);
+
+/* Finish the output: flush, sync and rename it into place */
+Status commit_output(OutputFile *out);
+
+/* Flush a file changed in place and sync it as --sync asks */
+Status sync_in_place(FILE *fptr);
+
+/* Drop an unfinished output; does nothing once committed */
+void abort_output(OutputFile *out);
+
+/* Sync and rename every output waiting for a group sync */
+Status flush_output_group(void);
+
+/* Put fname in place first if it is an output waiting for a group sync */
+Status flush_pending_output(const char *fname);
+
+#endif
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "parallel.h"
+#include "colour.h"
+
+/* Arguments handed to one worker thread */
+typedef struct _RowSlice
+{
+    RowWorker worker; // Function to run
+    void *ctx;        // Caller data
+    uint row_begin;   // First row of the slice
+    uint row_end;     // One past the last row
+    int thread_id;    // Index of the slice
+} RowSlice;
+
+/* Function Definitions */
+
+// Number of worker threads to use
+int get_thread_count(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        return 1;
+    if (cpus > MAX_THREADS)
+        return MAX_THREADS;
+    return (int)cpus;
+}
+
+// Thread entry point
+static void *run_slice(void *arg)
+{
+    RowSlice *slice = arg;
+    slice->worker(slice->ctx, slice->row_begin, slice->row_end, slice->thread_id);
+    return NULL;
+}
+
+/* Run worker over rows in parallel
+ * Description: Slice i is run by thread i; slice 0 runs on the calling
+ * thread. Small jobs (or a single CPU) just run inline.
+ */
+Status run_parallel_rows(uint rows, RowWorker worker, void *ctx)
+{
+    int nthreads = get_thread_count();
+    if ((uint)nthreads > rows)
+        nthreads = rows > 0 ? (int)rows : 1;
+
+    RowSlice slices[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    int started[MAX_THREADS] = {0};
+    Status status = success;
+
+    for (int i = 0; i < nthreads; i++)
+    {
+        slices[i].worker = worker;
+        slices[i].ctx = ctx;
+        slices[i].row_begin = (uint)((unsigned long long)rows * i / nthreads);
+        slices[i].row_end = (uint)((unsigned long long)rows * (i + 1) / nthreads);
+        slices[i].thread_id = i;
+    }
+
+    for (int i = 1; i < nthreads; i++)
+    {
+        if (pthread_create(&tids[i], NULL, run_slice, &slices[i]) == 0)
+            started[i] = 1;
+        else
+        {
+            // Could not get a thread, do this slice inline instead
+            fprintf(stderr, YELLOW"WARNING: Unable to start worker thread %d\n"RESET, i);
+            run_slice(&slices[i]);
+        }
+    }
+
+    run_slice(&slices[0]);
+
+    for (int i = 1; i < nthreads; i++)
+    {
+        if (started[i] && pthread_join(tids[i], NULL) != 0)
+            status = failure;
+    }
+    return status;
+}
+
+// Slice of rows for one thread of the pool
+static void run_pool_slice(RowPool *pool, int thread_id)
+{
+    uint begin = (uint)((unsigned long long)pool->rows * thread_id / pool->nthreads);
+    uint end = (uint)((unsigned long long)pool->rows * (thread_id + 1) / pool->nthreads);
+    if (begin < end)
+        pool->worker(pool->ctx, begin, end, thread_id);
+}
+
+// Pool thread: wait for a band, run its slice, repeat
+static void *pool_thread(void *arg)
+{
+    PoolThread *thread = arg;
+    RowPool *pool = thread->pool;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1)
+    {
+        while (!pool->stopping && pool->generation == seen)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stopping)
+            break;
+        seen = pool->generation;
+
+        pthread_mutex_unlock(&pool->lock);
+        run_pool_slice(pool, thread->thread_id);
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->busy == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* Start the pool threads
+ * Description: If a thread can't be started the pool just runs with
+ * the ones it has, down to the calling thread alone.
+ */
+Status open_row_pool(RowPool *pool)
+{
+    int nthreads = get_thread_count();
+
+    pool->nthreads = 1;
+    pool->generation = 0;
+    pool->busy = 0;
+    pool->stopping = 0;
+    if (pthread_mutex_init(&pool->lock, NULL) != 0)
+        return failure;
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 1; i < nthreads; i++)
+    {
+        PoolThread *thread = &pool->threads[i];
+        thread->pool = pool;
+        thread->thread_id = i;
+        if (pthread_create(&thread->tid, NULL, pool_thread, thread) != 0)
+        {
+            fprintf(stderr, YELLOW"WARNING: Unable to start worker thread %d\n"RESET, i);
+            break;
+        }
+        pool->nthreads++;
+    }
+    return success;
+}
+
+/* Run worker over rows on the pool
+ * Description: Slice 0 runs on the calling thread, which then waits for
+ * the pool threads to finish theirs.
+ */
+Status run_pool_rows(RowPool *pool, uint rows, RowWorker worker, void *ctx)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->worker = worker;
+    pool->ctx = ctx;
+    pool->rows = rows;
+    pool->busy = pool->nthreads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_pool_slice(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    return success;
+}
+
+/* Stop and join the pool threads */
+void close_row_pool(RowPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i].tid, NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+}
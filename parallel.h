@@ -0,0 +1,61 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <pthread.h>
+#include "types.h" // Contains user defined types
+
+/* Upper limit on the worker threads used for one image */
+#define MAX_THREADS 64
+
+/*
+ * Worker called for one slice of rows [row_begin, row_end).
+ * thread_id is in [0, get_thread_count()) and can be used to index
+ * per thread accumulators, so no locking is needed in the worker.
+ */
+typedef void (*RowWorker)(void *ctx, uint row_begin, uint row_end, int thread_id);
+
+struct _RowPool;
+
+/* One thread of a RowPool */
+typedef struct _PoolThread
+{
+    struct _RowPool *pool;
+    pthread_t tid;
+    int thread_id;
+} PoolThread;
+
+/*
+ * Worker threads kept for a whole image, so that streaming it band by
+ * band does not start new threads for every band
+ */
+typedef struct _RowPool
+{
+    PoolThread threads[MAX_THREADS]; // Entry 0 stands for the calling thread
+    int nthreads;                    // Threads per band, the calling thread included
+    pthread_mutex_t lock;
+    pthread_cond_t start;            // A band was posted
+    pthread_cond_t done;             // A thread finished its slice
+    RowWorker worker;                // Current band
+    void *ctx;
+    uint rows;
+    unsigned long generation;        // Bumped for every band
+    int busy;                        // Pool threads still working on the band
+    int stopping;
+} RowPool;
+
+/* Number of worker threads to use (online CPUs, capped at MAX_THREADS) */
+int get_thread_count(void);
+
+/* Split rows into one contiguous slice per thread and run worker on each */
+Status run_parallel_rows(uint rows, RowWorker worker, void *ctx);
+
+/* Start the pool threads (get_thread_count() - 1 of them) */
+Status open_row_pool(RowPool *pool);
+
+/* Same as run_parallel_rows(), on the threads of the pool */
+Status run_pool_rows(RowPool *pool, uint rows, RowWorker worker, void *ctx);
+
+/* Stop and join the pool threads */
+void close_row_pool(RowPool *pool);
+
+#endif
@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "quality.h"
+#include "encode.h"
+#include "parallel.h"
+#include "stream.h"
+#include "colour.h"
+
+/* Rows read and compared per band (a multiple of SSIM_TILE) */
+#define BAND_ROWS 256
+
+/* Periods of 16 * channels bytes compared before the 8 bit counters can wrap */
+#define DIFF_BLOCK_PERIODS 255
+
+/* SSIM constants for 8 bit samples: (0.01 * 255)^2 and (0.03 * 255)^2 */
+#define SSIM_C1 6.5025
+#define SSIM_C2 58.5225
+
+/* Per thread accumulators, merged after every band */
+typedef struct _QualityStats
+{
+    unsigned long long changed[QUALITY_CHANNELS];
+    unsigned long long squared_err[QUALITY_CHANNELS];
+    double ssim_sum[QUALITY_CHANNELS];
+    unsigned long long ssim_tiles;
+} QualityStats;
+
+/* Data shared by the workers of one band */
+typedef struct _QualityJob
+{
+    QualityInfo *qInfo;
+    const unsigned char *cover; // Rows of the current cover band
+    const unsigned char *stego; // Rows of the current stego band
+    uint rows;                  // Rows in the band
+    QualityStats *stats;        // One per thread
+} QualityJob;
+
+/* Function Definitions */
+
+/* Read and validate quality arguments */
+Status read_and_validate_quality_args(char *argv[], QualityInfo *qInfo)
+{
+    for (int i = 2; i <= 3; i++)
+    {
+        char *dot = argv[i] ? strrchr(argv[i], '.') : NULL;
+        if (dot == NULL || strcmp(dot, ".bmp") != 0)
+        {
+            fprintf(stderr, RED"ERROR: Cover and stego images must be .bmp\n"RESET);
+            return failure;
+        }
+    }
+
+    qInfo->cover_fname = argv[2];
+    qInfo->stego_fname = argv[3];
+    return success;
+}
+
+// SSIM of one tile of one channel
+static double tile_ssim(const unsigned char *cover, const unsigned char *stego, uint stride, uint channels)
+{
+    uint sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+    for (uint y = 0; y < SSIM_TILE; y++)
+    {
+        const unsigned char *a = cover + (size_t)y * stride;
+        const unsigned char *b = stego + (size_t)y * stride;
+        for (uint x = 0; x < SSIM_TILE; x++)
+        {
+            uint va = a[x * channels], vb = b[x * channels];
+            sx += va;
+            sy += vb;
+            sxx += va * va;
+            syy += vb * vb;
+            sxy += va * vb;
+        }
+    }
+
+    double n = SSIM_TILE * SSIM_TILE;
+    double mx = sx / n, my = sy / n;
+    double vx = sxx / n - mx * mx;
+    double vy = syy / n - my * my;
+    double cov = sxy / n - mx * my;
+    return ((2 * mx * my + SSIM_C1) * (2 * cov + SSIM_C2)) /
+           ((mx * mx + my * my + SSIM_C1) * (vx + vy + SSIM_C2));
+}
+
+/* Changed bytes and squared error of row bytes [x, end), channel of byte x first */
+static void diff_bytes_scalar(const unsigned char *a, const unsigned char *b, uint x, uint end,
+                              uint channels, QualityStats *stats)
+{
+    for (uint c = x % channels; x < end; x++)
+    {
+        int diff = (int)a[x] - (int)b[x];
+        stats->changed[c] += diff != 0;
+        stats->squared_err[c] += (unsigned long long)(diff * diff);
+        if (++c == channels)
+            c = 0;
+    }
+}
+
+#ifdef __SSE2__
+
+/* Changed bytes and squared error of a row, 16 bytes at a time
+ * Description: The row is read contiguously in periods of 16 * channels
+ * bytes (3 or 4 vectors), so every lane of vector v always holds the
+ * same channel. Unchanged bytes are counted with 8 bit counters and
+ * squares are added in 32 bit lanes; every DIFF_BLOCK_PERIODS periods
+ * the lanes are added to their channels, before either can wrap.
+ * Returns the first byte left for diff_bytes_scalar().
+ */
+static uint diff_bytes_simd(const unsigned char *a, const unsigned char *b, uint len,
+                            uint channels, QualityStats *stats)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint period = 16 * channels;
+    uint x = 0;
+
+    while (x + period <= len)
+    {
+        __m128i same[QUALITY_CHANNELS], squared[QUALITY_CHANNELS][4];
+        for (uint v = 0; v < channels; v++)
+        {
+            same[v] = zero;
+            for (int k = 0; k < 4; k++)
+                squared[v][k] = zero;
+        }
+
+        uint periods = 0;
+        for (; x + period <= len && periods < DIFF_BLOCK_PERIODS; x += period, periods++)
+        {
+            for (uint v = 0; v < channels; v++)
+            {
+                __m128i va = _mm_loadu_si128((const __m128i *)(a + x + 16 * v));
+                __m128i vb = _mm_loadu_si128((const __m128i *)(b + x + 16 * v));
+                __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+                same[v] = _mm_sub_epi8(same[v], _mm_cmpeq_epi8(diff, zero));
+
+                // |diff|^2 fits in 16 bits unsigned, widened to 32 before adding up
+                __m128i lo = _mm_unpacklo_epi8(diff, zero), hi = _mm_unpackhi_epi8(diff, zero);
+                lo = _mm_mullo_epi16(lo, lo);
+                hi = _mm_mullo_epi16(hi, hi);
+                squared[v][0] = _mm_add_epi32(squared[v][0], _mm_unpacklo_epi16(lo, zero));
+                squared[v][1] = _mm_add_epi32(squared[v][1], _mm_unpackhi_epi16(lo, zero));
+                squared[v][2] = _mm_add_epi32(squared[v][2], _mm_unpacklo_epi16(hi, zero));
+                squared[v][3] = _mm_add_epi32(squared[v][3], _mm_unpackhi_epi16(hi, zero));
+            }
+        }
+
+        // Lane j of vector v is byte 16 * v + j of the period
+        for (uint v = 0; v < channels; v++)
+        {
+            unsigned char same_lanes[16];
+            unsigned int squared_lanes[16];
+            _mm_storeu_si128((__m128i *)same_lanes, same[v]);
+            for (int k = 0; k < 4; k++)
+                _mm_storeu_si128((__m128i *)(squared_lanes + 4 * k), squared[v][k]);
+            for (uint j = 0; j < 16; j++)
+            {
+                uint c = (16 * v + j) % channels;
+                stats->changed[c] += periods - same_lanes[j];
+                stats->squared_err[c] += squared_lanes[j];
+            }
+        }
+    }
+    return x;
+}
+
+#endif
+
+/* Compare a slice of tile rows of the current band */
+static void compare_rows(void *ctx, uint tile_begin, uint tile_end, int thread_id)
+{
+    QualityJob *job = ctx;
+    QualityInfo *qInfo = job->qInfo;
+    QualityStats *stats = &job->stats[thread_id];
+    uint stride = qInfo->row_stride;
+    uint channels = qInfo->channels;
+    uint row_bytes = qInfo->width * channels;
+
+    for (uint tile_row = tile_begin; tile_row < tile_end; tile_row++)
+    {
+        uint row_begin = tile_row * SSIM_TILE;
+        uint row_end = row_begin + SSIM_TILE < job->rows ? row_begin + SSIM_TILE : job->rows;
+
+        // Changed bytes and squared error, the padding left out
+        for (uint row = row_begin; row < row_end; row++)
+        {
+            const unsigned char *a = job->cover + (size_t)row * stride;
+            const unsigned char *b = job->stego + (size_t)row * stride;
+            uint x = 0;
+#ifdef __SSE2__
+            x = diff_bytes_simd(a, b, row_bytes, channels, stats);
+#endif
+            diff_bytes_scalar(a, b, x, row_bytes, channels, stats);
+        }
+
+        // SSIM only on full tiles
+        if (row_end - row_begin < SSIM_TILE)
+            continue;
+        const unsigned char *a = job->cover + (size_t)row_begin * stride;
+        const unsigned char *b = job->stego + (size_t)row_begin * stride;
+        for (uint x = 0; x + SSIM_TILE <= qInfo->width; x += SSIM_TILE)
+        {
+            for (uint c = 0; c < channels; c++)
+                stats->ssim_sum[c] += tile_ssim(a + (size_t)x * channels + c, b + (size_t)x * channels + c, stride, channels);
+            stats->ssim_tiles++;
+        }
+    }
+}
+
+/* Stream both pixel arrays band by band
+ * Description: Each band is split across the threads of one pool kept
+ * for the whole image, in whole tile rows, so no SSIM tile straddles
+ * two threads.
+ */
+Status compare_pixel_arrays(QualityInfo *qInfo)
+{
+    RowPool pool;
+    if (open_row_pool(&pool) == failure)
+        return failure;
+
+    int nthreads = pool.nthreads;
+    size_t band_size = (size_t)qInfo->row_stride * BAND_ROWS;
+    unsigned char *cover = malloc(band_size);
+    unsigned char *stego = malloc(band_size);
+    QualityStats *stats = calloc(nthreads, sizeof(QualityStats));
+    Status status = success;
+
+    if (cover == NULL || stego == NULL || stats == NULL)
+    {
+        fprintf(stderr, RED"ERROR: Unable to allocate compare buffers\n"RESET);
+        free(cover);
+        free(stego);
+        free(stats);
+        close_row_pool(&pool);
+        return failure;
+    }
+
+    QualityJob job = { qInfo, cover, stego, 0, stats };
+    uint rows_left = qInfo->height;
+
+    while (rows_left > 0)
+    {
+        uint rows = rows_left < BAND_ROWS ? rows_left : BAND_ROWS;
+        if (fread(cover, qInfo->row_stride, rows, qInfo->fptr_cover) != rows ||
+            fread(stego, qInfo->row_stride, rows, qInfo->fptr_stego) != rows)
+        {
+            fprintf(stderr, RED"ERROR: Pixel array is truncated\n"RESET);
+            status = failure;
+            break;
+        }
+
+        job.rows = rows;
+        if (run_pool_rows(&pool, (rows + SSIM_TILE - 1) / SSIM_TILE, compare_rows, &job) == failure)
+        {
+            status = failure;
+            break;
+        }
+        rows_left -= rows;
+    }
+
+    // Merge the per thread counters
+    for (int t = 0; t < nthreads; t++)
+    {
+        for (uint c = 0; c < QUALITY_CHANNELS; c++)
+        {
+            qInfo->changed[c] += stats[t].changed[c];
+            qInfo->squared_err[c] += stats[t].squared_err[c];
+            qInfo->ssim_sum[c] += stats[t].ssim_sum[c];
+        }
+        qInfo->ssim_tiles += stats[t].ssim_tiles;
+    }
+
+    free(cover);
+    free(stego);
+    free(stats);
+    close_row_pool(&pool);
+    return status;
+}
+
+// Write a JSON string, escaping quotes, backslashes and control characters
+static void write_json_string(FILE *fptr, const char *str)
+{
+    fputc('"', fptr);
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            fprintf(fptr, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(fptr, "\\u%04x", *p);
+        else
+            fputc(*p, fptr);
+    }
+    fputc('"', fptr);
+}
+
+// PSNR from the mean squared error
+static double get_psnr(double mse)
+{
+    if (mse <= 0)
+        return PSNR_MAX;
+    double psnr = 10 * log10(255.0 * 255.0 / mse);
+    return psnr > PSNR_MAX ? PSNR_MAX : psnr;
+}
+
+/* Write the metrics as JSON */
+void write_quality_json(QualityInfo *qInfo, FILE *fptr)
+{
+    const char *names[QUALITY_CHANNELS] = { "blue", "green", "red", "alpha" };
+    unsigned long long samples = (unsigned long long)qInfo->width * qInfo->height;
+    unsigned long long changed = 0, squared = 0;
+    double ssim = 0;
+
+    fprintf(fptr, "{\n  \"cover\": ");
+    write_json_string(fptr, qInfo->cover_fname);
+    fprintf(fptr, ",\n  \"stego\": ");
+    write_json_string(fptr, qInfo->stego_fname);
+    fprintf(fptr, ",\n  \"width\": %u,\n  \"height\": %u,\n  \"bits_per_pixel\": %u,\n",
+            qInfo->width, qInfo->height, qInfo->bpp);
+
+    fprintf(fptr, "  \"channels\": {\n");
+    for (uint c = 0; c < qInfo->channels; c++)
+    {
+        double mse = samples ? (double)qInfo->squared_err[c] / samples : 0;
+        double channel_ssim = qInfo->ssim_tiles ? qInfo->ssim_sum[c] / qInfo->ssim_tiles : 1;
+        fprintf(fptr, "    \"%s\": { \"changed_bytes\": %llu, \"mse\": %.6f, \"psnr\": %.4f, \"ssim\": %.6f }%s\n",
+                names[c], qInfo->changed[c], mse, get_psnr(mse), channel_ssim,
+                c + 1 < qInfo->channels ? "," : "");
+        changed += qInfo->changed[c];
+        squared += qInfo->squared_err[c];
+        ssim += channel_ssim;
+    }
+    fprintf(fptr, "  },\n");
+
+    unsigned long long bytes = samples * qInfo->channels;
+    double mse = bytes ? (double)squared / bytes : 0;
+    fprintf(fptr, "  \"bytes_compared\": %llu,\n", bytes);
+    fprintf(fptr, "  \"changed_bytes\": %llu,\n", changed);
+    fprintf(fptr, "  \"changed_ratio\": %.8f,\n", bytes ? (double)changed / bytes : 0);
+    fprintf(fptr, "  \"mse\": %.6f,\n", mse);
+    fprintf(fptr, "  \"psnr\": %.4f,\n", get_psnr(mse));
+    fprintf(fptr, "  \"ssim\": %.6f,\n", qInfo->channels ? ssim / qInfo->channels : 1);
+    fprintf(fptr, "  \"ssim_tile\": %d,\n", SSIM_TILE);
+    fprintf(fptr, "  \"seconds\": %.3f\n}\n", qInfo->seconds);
+}
+
+// Open an image and read its header
+static Status open_quality_image(const char *fname, FILE **fptr, char *header)
+{
+    *fptr = fopen(fname, "r");
+    if (*fptr == NULL)
+    {
+        fprintf(stderr, RED"ERROR: Unable to open %s\n"RESET, fname);
+        return failure;
+    }
+    return read_bmp_header(*fptr, header);
+}
+
+// Close whichever images are open
+static void close_quality_images(QualityInfo *qInfo)
+{
+    if (qInfo->fptr_cover != NULL)
+        fclose(qInfo->fptr_cover);
+    if (qInfo->fptr_stego != NULL)
+        fclose(qInfo->fptr_stego);
+    qInfo->fptr_cover = NULL;
+    qInfo->fptr_stego = NULL;
+}
+
+/* Master comparison process */
+Status do_quality(QualityInfo *qInfo)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // 1. Open both images
+    printf(YELLOW"INFO: Opening images\n"RESET);
+    if (open_quality_image(qInfo->cover_fname, &qInfo->fptr_cover, qInfo->cover_header) == failure ||
+        open_quality_image(qInfo->stego_fname, &qInfo->fptr_stego, qInfo->stego_header) == failure)
+    {
+        close_quality_images(qInfo);
+        return failure;
+    }
+    printf(GREEN"SUCCESS: Opened images\n"RESET);
+
+    // 2. Both must have the same geometry
+    uint width, height, bpp;
+    get_bmp_dimensions(qInfo->cover_header, &qInfo->width, &qInfo->height, &qInfo->bpp);
+    get_bmp_dimensions(qInfo->stego_header, &width, &height, &bpp);
+    if (width != qInfo->width || height != qInfo->height || bpp != qInfo->bpp)
+    {
+        fprintf(stderr, RED"ERROR: Cover and stego images differ in size or depth\n"RESET);
+        close_quality_images(qInfo);
+        return failure;
+    }
+    if (bpp != 24 && bpp != 32)
+    {
+        fprintf(stderr, RED"ERROR: Only 24 and 32 bpp images can be compared (got %u)\n"RESET, bpp);
+        close_quality_images(qInfo);
+        return failure;
+    }
+    qInfo->channels = bpp / 8;
+    qInfo->row_stride = get_row_stride(qInfo->cover_header);
+
+    // 3. Compare pixel arrays
+    printf(YELLOW"INFO: Comparing pixel arrays\n"RESET);
+    if (compare_pixel_arrays(qInfo) == failure)
+    {
+        close_quality_images(qInfo);
+        return failure;
+    }
+    printf(GREEN"SUCCESS: Compared pixel arrays\n"RESET);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    qInfo->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    close_quality_images(qInfo);
+    return success;
+}
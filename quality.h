@@ -0,0 +1,59 @@
+#ifndef QUALITY_H
+#define QUALITY_H
+
+#include <stdio.h>
+#include "types.h"  // Contains user defined types
+#include "common.h" // Contains BMP_HEADER_SIZE
+
+/* Up to 4 channels (B, G, R, A) */
+#define QUALITY_CHANNELS 4
+
+/* SSIM is computed on tiles of this many pixels square */
+#define SSIM_TILE 8
+
+/* PSNR reported for identical images */
+#define PSNR_MAX 100.0
+
+/*
+ * Structure to store information required for
+ * comparing a cover image with its stego image, and the results
+ */
+typedef struct _QualityInfo
+{
+    /* Image info */
+    char *cover_fname;                      // To store the cover image name
+    char *stego_fname;                      // To store the stego image name
+    FILE *fptr_cover;                       // To store the address of the cover image
+    FILE *fptr_stego;                       // To store the address of the stego image
+    char cover_header[BMP_HEADER_SIZE];     // To store the cover BMP header
+    char stego_header[BMP_HEADER_SIZE];     // To store the stego BMP header
+    uint width;                             // Width in pixels
+    uint height;                            // Height in pixels
+    uint bpp;                               // Bits per pixel
+    uint channels;                          // 3 for 24 bpp, 4 for 32 bpp
+    uint row_stride;                        // Bytes per row including padding
+
+    /* Results */
+    unsigned long long changed[QUALITY_CHANNELS];     // Changed bytes per channel
+    unsigned long long squared_err[QUALITY_CHANNELS]; // Sum of squared differences per channel
+    double ssim_sum[QUALITY_CHANNELS];                // Sum of tile SSIM per channel
+    unsigned long long ssim_tiles;                    // Tiles per channel
+    double seconds;                                   // Time taken
+
+} QualityInfo;
+
+/* Quality function prototypes */
+
+/* Read and validate Quality args from argv */
+Status read_and_validate_quality_args(char *argv[], QualityInfo *qInfo);
+
+/* Perform the comparison */
+Status do_quality(QualityInfo *qInfo);
+
+/* Stream both pixel arrays and collect the metrics */
+Status compare_pixel_arrays(QualityInfo *qInfo);
+
+/* Write the metrics as JSON */
+void write_quality_json(QualityInfo *qInfo, FILE *fptr);
+
+#endif
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "stream.h"
+#include "encode.h"
+#include "common.h"
+#include "colour.h"
+
+/* Function Definitions */
+
+/* Check whether a file name means stdin/stdout */
+int is_stream_fname(const char *fname)
+{
+    return fname != NULL && strcmp(fname, STREAM_FNAME) == 0;
+}
+
+/* Get a FILE pointer for the real stdout
+ * Description: All the INFO/SUCCESS logs are printed on stdout. When the
+ * stego image (or secret) itself goes to stdout, the logs would corrupt
+ * it, so the real stdout is duplicated for the data and stdout is pointed
+ * at stderr for the logs.
+ */
+FILE *open_stdout_stream(void)
+{
+    static FILE *fptr_stream = NULL;
+
+    if (fptr_stream != NULL)
+        return fptr_stream;
+
+    fflush(stdout);
+    int data_fd = dup(STDOUT_FILENO);
+    if (data_fd < 0)
+    {
+        perror(RED"ERROR: Unable to duplicate stdout"RESET);
+        return NULL;
+    }
+
+    if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+    {
+        perror(RED"ERROR: Unable to redirect logs to stderr"RESET);
+        close(data_fd);
+        return NULL;
+    }
+
+    fptr_stream = fdopen(data_fd, "w");
+    if (fptr_stream == NULL)
+        close(data_fd);
+    return fptr_stream;
+}
+
+/* Get a FILE pointer for the real stdout and discard the console logs
+ * Description: Batch and watch modes run many jobs at once; the per step
+ * logs of every job would interleave, so they are sent to /dev/null and
+ * only the caller's report goes to the real stdout. Errors printed on
+ * stderr are kept.
+ */
+FILE *open_quiet_stdout(void)
+{
+    fflush(stdout);
+    int report_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (report_fd < 0 || null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0)
+    {
+        perror(RED"ERROR: Unable to redirect logs"RESET);
+        if (report_fd >= 0)
+            close(report_fd);
+        if (null_fd >= 0)
+            close(null_fd);
+        return NULL;
+    }
+    close(null_fd);
+
+    FILE *fptr_report = fdopen(report_fd, "w");
+    if (fptr_report == NULL)
+        close(report_fd);
+    else
+        setvbuf(fptr_report, NULL, _IOLBF, 0);
+    return fptr_report;
+}
+
+/* Read the BMP header (first 54 bytes) without seeking */
+Status read_bmp_header(FILE *fptr_image, char *header)
+{
+    if (fread(header, 1, BMP_HEADER_SIZE, fptr_image) != BMP_HEADER_SIZE)
+    {
+        fprintf(stderr, RED"ERROR: Unable to read BMP header\n"RESET);
+        return failure;
+    }
+
+    if (header[0] != 'B' || header[1] != 'M')
+    {
+        fprintf(stderr, RED"ERROR: Not a BMP image\n"RESET);
+        return failure;
+    }
+
+    // Dimensions come from the file, keep them where uint arithmetic can't wrap
+    uint width, height, bpp;
+    get_bmp_dimensions(header, &width, &height, &bpp);
+    if (width == 0 || width > INT_MAX || height == 0 || bpp == 0 || bpp > 32 ||
+        get_pixel_array_size(header) > BMP_MAX_PIXEL_BYTES)
+    {
+        fprintf(stderr, RED"ERROR: Invalid BMP dimensions %ux%u, %u bpp\n"RESET, width, height, bpp);
+        return failure;
+    }
+    return success;
+}
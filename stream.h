@@ -0,0 +1,25 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+#include "types.h" // Contains user defined types
+
+/*
+ * Helpers for the forward-only streaming mode, where the cover/stego
+ * image is read from stdin and/or the output is written to stdout.
+ * Nothing in here ever seeks, so pipes and sockets work.
+ */
+
+/* Check whether a file name means stdin/stdout ("-") */
+int is_stream_fname(const char *fname);
+
+/* Get a FILE pointer for the real stdout and send the console logs to stderr */
+FILE *open_stdout_stream(void);
+
+/* Get a FILE pointer for the real stdout and discard the console logs */
+FILE *open_quiet_stdout(void);
+
+/* Read the BMP header once, forward-only */
+Status read_bmp_header(FILE *fptr_image, char *header);
+
+#endif
@@ -17,6 +17,11 @@ typedef enum
 {
     encode,
     decode,
+    analyze,
+    update,
+    quality,
+    batch,
+    watch,
     unsupported
 } OperationType;
 
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <string.h>
+#include "update.h"
+#include "decode.h"
+#include "stream.h"
+#include "output.h"
+#include "common.h"
+#include "colour.h"
+
+/* Payload bytes compared per block */
+#define UPDATE_BLOCK 4096
+
+/* Function Definitions */
+
+/* Open the stego image read-write and the new secret */
+Status open_files_update(EncodeInfo *encInfo)
+{
+    if (is_stream_fname(encInfo->src_image_fname))
+    {
+        printf(RED"ERROR: In-place update needs a stego image file, not stdin\n"RESET);
+        return failure;
+    }
+
+    printf(YELLOW"INFO: Opening stego image for update\n"RESET);
+    encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "r+");
+    if (!encInfo->fptr_src_image)
+    {
+        perror(RED"ERROR: Unable to open stego image file"RESET);
+        return failure;
+    }
+    printf(GREEN"SUCCESS: Stego image opened:"RESET BOLD"%s\n"RESET, encInfo->src_image_fname);
+
+    printf(YELLOW"INFO: Opening secret file\n"RESET);
+    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");
+    if (!encInfo->fptr_secret)
+    {
+        perror(RED"ERROR: Unable to open secret file"RESET);
+        return failure;
+    }
+    printf(GREEN"SUCCESS: Secret file opened:"RESET BOLD"%s\n"RESET, encInfo->secret_fname);
+
+    encInfo->fptr_stego_image = NULL;
+    return success;
+}
+
+// Decode len payload bytes starting at payload byte payload_pos
+static Status read_payload(FILE *fptr_image, long payload_pos, char *data, uint len)
+{
+    char buffer[8];
+    if (fseek(fptr_image, BMP_HEADER_SIZE + payload_pos * 8, SEEK_SET) != 0)
+        return failure;
+    for (uint i = 0; i < len; i++)
+    {
+        if (fread(buffer, 1, 8, fptr_image) != 8)
+            return failure;
+        decode_byte_from_lsb(buffer, &data[i]);
+    }
+    return success;
+}
+
+// Big endian 4 byte value, the same bits encode_size_to_lsb() hides
+static uint get_payload_word(const char *data)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    return ((uint)p[0] << 24) | ((uint)p[1] << 16) | ((uint)p[2] << 8) | p[3];
+}
+
+static void put_payload_word(char *data, uint value)
+{
+    data[0] = (char)(value >> 24);
+    data[1] = (char)(value >> 16);
+    data[2] = (char)(value >> 8);
+    data[3] = (char)value;
+}
+
+/* Check the stego image holds a single file and print what it holds */
+Status read_embedded_header(EncodeInfo *encInfo)
+{
+    int ms_len = strlen(MAGIC_STRING);
+    char fields[sizeof(MAGIC_STRING) + 4];
+    char extn[5] = {0};
+    char size[4];
+
+    rewind(encInfo->fptr_src_image);
+    if (read_bmp_header(encInfo->fptr_src_image, encInfo->bmp_header) == failure)
+        return failure;
+    encInfo->image_capacity = get_image_size_from_header(encInfo->bmp_header);
+
+    if (read_payload(encInfo->fptr_src_image, 0, fields, ms_len + 4) == failure)
+        return failure;
+
+    if (strncmp(fields, MAGIC_STRING, ms_len) != 0)
+    {
+        if (strncmp(fields, ARCHIVE_MAGIC, ms_len) == 0)
+            fprintf(stderr, RED"ERROR: Image holds several files, re-encode it instead\n"RESET);
+        else
+            fprintf(stderr, RED"ERROR: Magic string not found! Not a stego image.\n"RESET);
+        return failure;
+    }
+
+    uint extn_size = get_payload_word(fields + ms_len);
+    if (extn_size >> CHANNEL_MASK_SHIFT)
+    {
+        fprintf(stderr, RED"ERROR: Image was encoded with a channel mask or adaptive mode, re-encode it instead\n"RESET);
+        return failure;
+    }
+    if (extn_size < 1 || extn_size > 4 ||
+        read_payload(encInfo->fptr_src_image, ms_len + 4, extn, extn_size) == failure ||
+        read_payload(encInfo->fptr_src_image, ms_len + 4 + extn_size, size, 4) == failure)
+    {
+        fprintf(stderr, RED"ERROR: Embedded header is invalid\n"RESET);
+        return failure;
+    }
+
+    printf(MAGENTA"INFO: Embedded secret: "RESET BOLD"%u bytes, extension %s\n"RESET,
+           get_payload_word(size), extn);
+    return success;
+}
+
+/* Rewrite only the image bytes whose LSBs change
+ * Description: The embedded bytes of the block are decoded and compared
+ * with the new payload; only runs of differing bytes are written back.
+ */
+Status update_payload_block(FILE *fptr_image, long payload_pos, const char *payload, uint len, UpdateStats *stats)
+{
+    char buffer[UPDATE_BLOCK * 8];
+    long offset = BMP_HEADER_SIZE + payload_pos * 8;
+
+    if (fseek(fptr_image, offset, SEEK_SET) != 0 || fread(buffer, 8, len, fptr_image) != len)
+        return failure;
+
+    uint run_start = len; // len means no run open
+    for (uint i = 0; i <= len; i++)
+    {
+        int changed = 0;
+        if (i < len)
+        {
+            char old;
+            decode_byte_from_lsb(buffer + i * 8, &old);
+            if (old != payload[i])
+            {
+                encode_byte_to_lsb(payload[i], buffer + i * 8);
+                stats->changed_bytes++;
+                changed = 1;
+            }
+        }
+
+        if (changed && run_start == len)
+            run_start = i;
+        else if (!changed && run_start != len)
+        {
+            // Write back the run of changed bytes
+            if (fseek(fptr_image, offset + (long)run_start * 8, SEEK_SET) != 0 ||
+                fwrite(buffer + run_start * 8, 8, i - run_start, fptr_image) != i - run_start)
+                return failure;
+            stats->written_bytes += (unsigned long)(i - run_start) * 8;
+            run_start = len;
+        }
+    }
+
+    stats->payload_bytes += len;
+    return success;
+}
+
+/* Master update process */
+Status do_update(EncodeInfo *encInfo, UpdateStats *stats)
+{
+    // 1. Open files
+    if (open_files_update(encInfo) == failure)
+        return failure;
+
+    // 2. Check what the image holds
+    printf(YELLOW"INFO: Reading embedded header\n"RESET);
+    if (read_embedded_header(encInfo) == failure)
+        return failure;
+    printf(GREEN"SUCCESS: Embedded header verified\n"RESET);
+
+    // 3. Check capacity for the new payload
+    printf(YELLOW"INFO: Checking capacity\n"RESET);
+    uint secret_size;
+    if (get_file_size(&encInfo->fptr_secret, &secret_size) == failure)
+        return failure;
+    encInfo->size_secret_file = secret_size;
+    uint extn_size = strlen(encInfo->extn_secret_file);
+    unsigned long long payload_size = strlen(MAGIC_STRING) + 4 + extn_size + 4 + encInfo->size_secret_file;
+    if (payload_size * 8 > encInfo->image_capacity)
+    {
+        printf(RED"ERROR: Image does not have enough capacity: "RESET);
+        printf("%llu bytes/%llu bytes\n", payload_size * 8, encInfo->image_capacity);
+        return failure;
+    }
+    printf(GREEN"SUCCESS: Check capacity done\n"RESET);
+
+    // 4. Header fields: magic string, extn size, extn, file size
+    char fields[sizeof(MAGIC_STRING) + 4 + 4 + 4];
+    long pos = 0;
+    memcpy(fields + pos, MAGIC_STRING, strlen(MAGIC_STRING));
+    pos += strlen(MAGIC_STRING);
+    put_payload_word(fields + pos, extn_size);
+    pos += 4;
+    memcpy(fields + pos, encInfo->extn_secret_file, extn_size);
+    pos += extn_size;
+    put_payload_word(fields + pos, (uint)encInfo->size_secret_file);
+    pos += 4;
+    long fields_len = pos;
+
+    // 5. Secret data, block by block; the old fields still describe the image until step 6
+    printf(YELLOW"INFO: Updating secret file data\n"RESET);
+    char data[UPDATE_BLOCK];
+    size_t n;
+    while ((n = fread(data, 1, sizeof(data), encInfo->fptr_secret)) > 0)
+    {
+        if (update_payload_block(encInfo->fptr_src_image, pos, data, n, stats) == failure)
+        {
+            fprintf(stderr, RED"ERROR: Failed to update secret file data\n"RESET);
+            return failure;
+        }
+        pos += n;
+    }
+    if (sync_in_place(encInfo->fptr_src_image) == failure)
+    {
+        perror(RED"ERROR: Unable to write stego image"RESET);
+        return failure;
+    }
+    printf(GREEN"SUCCESS: Updating secret file data done\n"RESET);
+
+    // 6. Header fields last, once the data they describe is written
+    printf(YELLOW"INFO: Updating header fields\n"RESET);
+    if (update_payload_block(encInfo->fptr_src_image, 0, fields, fields_len, stats) == failure ||
+        sync_in_place(encInfo->fptr_src_image) == failure)
+    {
+        fprintf(stderr, RED"ERROR: Failed to update header fields\n"RESET);
+        return failure;
+    }
+    printf(GREEN"SUCCESS: Updating header fields done\n"RESET);
+
+    printf(MAGENTA"INFO: Changed "RESET BOLD"%lu"RESET MAGENTA" of "RESET BOLD"%lu"RESET
+           MAGENTA" payload bytes, rewrote "RESET BOLD"%lu"RESET MAGENTA" image bytes\n"RESET,
+           stats->changed_bytes, stats->payload_bytes, stats->written_bytes);
+
+    printf(YELLOW"INFO: Closing files\n"RESET);
+    fclose(encInfo->fptr_secret);
+    if (fclose(encInfo->fptr_src_image) != 0)
+    {
+        perror(RED"ERROR: Unable to write stego image"RESET);
+        return failure;
+    }
+    return success;
+}
@@ -0,0 +1,36 @@
+#ifndef UPDATE_H
+#define UPDATE_H
+
+#include <stdio.h>
+#include "types.h"  // Contains user defined types
+#include "encode.h" // Contains EncodeInfo
+
+/*
+ * In-place update of the secret held by an existing stego image.
+ * The stego image is opened read-write; EncodeInfo's fptr_src_image
+ * refers to it and fptr_stego_image is not used.
+ */
+
+/* Number of changed bytes/blocks written back by an update */
+typedef struct _UpdateStats
+{
+    unsigned long payload_bytes; // Bytes of the new payload
+    unsigned long changed_bytes; // Payload bytes that differ from the embedded ones
+    unsigned long written_bytes; // Image bytes actually rewritten
+} UpdateStats;
+
+/* Update function prototypes */
+
+/* Perform the update */
+Status do_update(EncodeInfo *encInfo, UpdateStats *stats);
+
+/* Open the stego image read-write and the new secret */
+Status open_files_update(EncodeInfo *encInfo);
+
+/* Check the stego image holds a single file and print what it holds */
+Status read_embedded_header(EncodeInfo *encInfo);
+
+/* Rewrite only the image bytes whose LSBs change for len payload bytes at payload_pos */
+Status update_payload_block(FILE *fptr_image, long payload_pos, const char *payload, uint len, UpdateStats *stats);
+
+#endif
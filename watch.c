@@ -0,0 +1,605 @@
+#define _GNU_SOURCE // ppoll()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <glob.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+#include "watch.h"
+#include "parallel.h"
+#include "output.h"
+#include "common.h"
+#include "colour.h"
+
+/* Function Definitions */
+
+// Seconds from a monotonic clock
+static double get_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int is_directory(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// "dir/name" in a new buffer
+static char *join_path(const char *dir, const char *name)
+{
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char *path = malloc(len);
+    if (path != NULL)
+        snprintf(path, len, "%s/%s", dir, name);
+    return path;
+}
+
+// Name without its last extension ("a.txt" -> "a")
+static char *get_stem(const char *name)
+{
+    char *stem = strdup(name);
+    char *dot = strrchr(stem, '.');
+    if (dot != NULL && dot != stem)
+        *dot = '\0';
+    return stem;
+}
+
+static int has_bmp_suffix(const char *name)
+{
+    size_t len = strlen(name);
+    return len > 4 && strcmp(name + len - 4, ".bmp") == 0;
+}
+
+/* Read and validate watch args from argv
+ *   --watch -e <cover_dir> <secret_dir> <out_dir>
+ *   --watch -d <stego_dir> <out_dir>
+ */
+Status read_and_validate_watch_args(int argc, char *argv[], WatchInfo *watchInfo)
+{
+    if (argc == 6 && strcmp(argv[2], "-e") == 0)
+    {
+        watchInfo->op = encode;
+        watchInfo->input_dir = argv[3];
+        watchInfo->secret_dir = argv[4];
+        watchInfo->out_dir = argv[5];
+    }
+    else if (argc == 5 && strcmp(argv[2], "-d") == 0)
+    {
+        watchInfo->op = decode;
+        watchInfo->input_dir = argv[3];
+        watchInfo->secret_dir = NULL;
+        watchInfo->out_dir = argv[4];
+    }
+    else
+    {
+        printf(RED"ERROR: Use --watch -e <cover_dir> <secret_dir> <out_dir> or --watch -d <stego_dir> <out_dir>\n"RESET);
+        return failure;
+    }
+
+    char *dirs[] = {watchInfo->input_dir, watchInfo->secret_dir, watchInfo->out_dir};
+    for (int i = 0; i < 3; i++)
+    {
+        if (dirs[i] != NULL && !is_directory(dirs[i]))
+        {
+            printf(RED"ERROR: %s is not a directory\n"RESET, dirs[i]);
+            return failure;
+        }
+    }
+
+    // Outputs landing in a watched directory would be picked up again
+    if ((watchInfo->secret_dir != NULL && strcmp(watchInfo->secret_dir, watchInfo->input_dir) == 0) ||
+        strcmp(watchInfo->out_dir, watchInfo->input_dir) == 0 ||
+        (watchInfo->secret_dir != NULL && strcmp(watchInfo->out_dir, watchInfo->secret_dir) == 0))
+    {
+        printf(RED"ERROR: Spool and output directories must all be different\n"RESET);
+        return failure;
+    }
+    return success;
+}
+
+/* Print the queue and latency counters */
+void print_watch_counters(WatchInfo *watchInfo)
+{
+    pthread_mutex_lock(&watchInfo->lock);
+    unsigned long done = watchInfo->ok + watchInfo->failed;
+    fprintf(watchInfo->fptr_report, BOLD"Queued: %lu, ok: %lu, failed: %lu, queue depth: %d (max %d), "
+            "latency avg %.3f s, max %.3f s\n"RESET,
+            watchInfo->queued, watchInfo->ok, watchInfo->failed, watchInfo->depth, watchInfo->max_depth,
+            done ? watchInfo->latency_sum / done : 0.0, watchInfo->latency_max);
+    pthread_mutex_unlock(&watchInfo->lock);
+}
+
+#ifdef __linux__
+
+// Remove and return the pending name with the given stem (NULL if none)
+static char *take_pending(PendingList *list, const char *stem)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        char *name_stem = get_stem(list->names[i]);
+        int match = strcmp(name_stem, stem) == 0;
+        free(name_stem);
+        if (match)
+        {
+            char *name = list->names[i];
+            list->names[i] = list->names[--list->count];
+            return name;
+        }
+    }
+    return NULL;
+}
+
+// Remember a name until its partner lands; a newer file with the same stem replaces it
+static void add_pending(PendingList *list, const char *name)
+{
+    char *stem = get_stem(name);
+    free(take_pending(list, stem));
+    free(stem);
+
+    if (list->count == list->capacity)
+    {
+        int capacity = list->capacity ? list->capacity * 2 : 64;
+        char **names = realloc(list->names, capacity * sizeof(char *));
+        if (names == NULL)
+            return;
+        list->names = names;
+        list->capacity = capacity;
+    }
+    list->names[list->count++] = strdup(name);
+}
+
+static void free_pending(PendingList *list)
+{
+    for (int i = 0; i < list->count; i++)
+        free(list->names[i]);
+    free(list->names);
+    list->names = NULL;
+    list->count = list->capacity = 0;
+}
+
+static void free_watch_job(WatchJob *wj)
+{
+    for (int a = 2; a < 6; a++)
+        free(wj->job.argv[a]);
+    free(wj);
+}
+
+/* Queue a job for a stego image, or a cover/secret pair when encoding */
+static void queue_job(WatchInfo *watchInfo, const char *input_name, const char *secret_name, double arrived)
+{
+    WatchJob *wj = calloc(1, sizeof(WatchJob));
+    char *stem = get_stem(input_name);
+    size_t len = stem != NULL ? strlen(stem) + 5 : 0;
+    char *output_name = malloc(len);
+    if (wj == NULL || stem == NULL || output_name == NULL)
+    {
+        free(wj);
+        free(stem);
+        free(output_name);
+        return;
+    }
+    // The decoder swaps the last extension for the embedded one
+    snprintf(output_name, len, "%s%s", stem, watchInfo->op == encode ? ".bmp" : ".out");
+    free(stem);
+
+    wj->arrived = arrived;
+    wj->job.op = watchInfo->op;
+    wj->job.argv[0] = "steg";
+    wj->job.argv[1] = watchInfo->op == encode ? "-e" : "-d";
+    wj->job.argv[2] = join_path(watchInfo->input_dir, input_name);
+    if (watchInfo->op == encode)
+    {
+        wj->job.argv[3] = join_path(watchInfo->secret_dir, secret_name);
+        wj->job.argv[4] = join_path(watchInfo->out_dir, output_name);
+    }
+    else
+        wj->job.argv[3] = join_path(watchInfo->out_dir, output_name);
+    free(output_name);
+
+    // The decoder adds the extension to a fixed size name
+    char *output = wj->job.argv[watchInfo->op == encode ? 4 : 3];
+    if (output == NULL || strlen(output) + MAX_FILE_SUFFIX >= sizeof(wj->job.result_fname))
+    {
+        fprintf(stderr, RED"ERROR: Output path for %s is too long\n"RESET, input_name);
+        pthread_mutex_lock(&watchInfo->lock);
+        watchInfo->failed++;
+        pthread_mutex_unlock(&watchInfo->lock);
+        free_watch_job(wj);
+        return;
+    }
+
+    pthread_mutex_lock(&watchInfo->lock);
+    while (watchInfo->depth == WATCH_QUEUE_SIZE)
+        pthread_cond_wait(&watchInfo->not_full, &watchInfo->lock);
+    watchInfo->queue[(watchInfo->head + watchInfo->depth) % WATCH_QUEUE_SIZE] = wj;
+    watchInfo->depth++;
+    watchInfo->queued++;
+    if (watchInfo->depth > watchInfo->max_depth)
+        watchInfo->max_depth = watchInfo->depth;
+    pthread_cond_signal(&watchInfo->not_empty);
+    pthread_mutex_unlock(&watchInfo->lock);
+}
+
+// Whether a job reads this cover/stego image or secret
+static int job_uses_path(const WatchJob *wj, const char *path)
+{
+    return (wj->job.argv[2] != NULL && strcmp(wj->job.argv[2], path) == 0) ||
+           (wj->job.op == encode && wj->job.argv[3] != NULL && strcmp(wj->job.argv[3], path) == 0);
+}
+
+// Whether a queued job (or, with running set, one being run) reads path; caller holds the lock
+static int job_in_flight(WatchInfo *watchInfo, const char *path, int running)
+{
+    for (int i = 0; i < watchInfo->depth; i++)
+        if (job_uses_path(watchInfo->queue[(watchInfo->head + i) % WATCH_QUEUE_SIZE], path))
+            return 1;
+    for (int i = 0; running && i < watchInfo->nrunning; i++)
+        if (job_uses_path(watchInfo->running[i], path))
+            return 1;
+    return 0;
+}
+
+/* A file was fully written into one of the spool directories
+ * Description: A file some queued job already reads is skipped, that job
+ * sees it as it is now. A rescan also skips files of running jobs, whose
+ * output does not exist yet; a new event for one of those is a rewrite
+ * and is queued again.
+ */
+static void handle_arrival(WatchInfo *watchInfo, int in_secret_dir, const char *name, double arrived, int rescan)
+{
+    if (name[0] == '.') // Hidden or temporary file
+        return;
+    if (!in_secret_dir && !has_bmp_suffix(name))
+        return;
+
+    char *path = join_path(in_secret_dir ? watchInfo->secret_dir : watchInfo->input_dir, name);
+    if (path == NULL)
+        return;
+    pthread_mutex_lock(&watchInfo->lock);
+    int in_flight = job_in_flight(watchInfo, path, rescan);
+    pthread_mutex_unlock(&watchInfo->lock);
+    free(path);
+    if (in_flight)
+        return;
+
+    if (watchInfo->op == decode)
+    {
+        queue_job(watchInfo, name, NULL, arrived);
+        return;
+    }
+
+    // Encoding starts when the second file of a pair lands
+    char *stem = get_stem(name);
+    if (!in_secret_dir)
+    {
+        char *secret = take_pending(&watchInfo->secrets, stem);
+        if (secret != NULL)
+            queue_job(watchInfo, name, secret, arrived);
+        else
+            add_pending(&watchInfo->covers, name);
+        free(secret);
+    }
+    else
+    {
+        char *cover = take_pending(&watchInfo->covers, stem);
+        if (cover != NULL)
+            queue_job(watchInfo, cover, name, arrived);
+        else
+            add_pending(&watchInfo->secrets, name);
+        free(cover);
+    }
+    free(stem);
+}
+
+// Whether a finished output for this input is already in the output directory
+static int output_exists(WatchInfo *watchInfo, const char *input_name)
+{
+    char *stem = get_stem(input_name);
+    char *path = join_path(watchInfo->out_dir, stem);
+    free(stem);
+    if (path == NULL)
+        return 0;
+
+    int exists;
+    if (watchInfo->op == encode)
+    {
+        size_t len = strlen(path) + 5;
+        char *bmp_path = malloc(len);
+        exists = bmp_path != NULL && snprintf(bmp_path, len, "%s.bmp", path) > 0 && access(bmp_path, F_OK) == 0;
+        free(bmp_path);
+    }
+    else
+    {
+        // The decoded file carries the embedded extension
+        size_t len = strlen(path) + 3;
+        char *pattern = malloc(len);
+        glob_t matches;
+        exists = access(path, F_OK) == 0;
+        if (!exists && pattern != NULL)
+        {
+            snprintf(pattern, len, "%s.*", path);
+            if (glob(pattern, 0, NULL, &matches) == 0)
+            {
+                exists = matches.gl_pathc > 0;
+                globfree(&matches);
+            }
+        }
+        free(pattern);
+    }
+    free(path);
+    return exists;
+}
+
+/* Files already in the spool
+ * Description: Inputs without an output are queued, secrets are kept as
+ * partners for covers that land later. Also used to catch up after the
+ * inotify queue overflowed.
+ */
+static void scan_spool(WatchInfo *watchInfo)
+{
+    double now = get_seconds();
+    char *dirs[] = {watchInfo->secret_dir, watchInfo->input_dir};
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (dirs[i] == NULL)
+            continue;
+        DIR *dir = opendir(dirs[i]);
+        if (dir == NULL)
+        {
+            perror(RED"ERROR: Unable to read spool directory"RESET);
+            continue;
+        }
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            int in_secret_dir = dirs[i] == watchInfo->secret_dir;
+            if (!in_secret_dir && output_exists(watchInfo, entry->d_name))
+                continue;
+            handle_arrival(watchInfo, in_secret_dir, entry->d_name, now, 1);
+        }
+        closedir(dir);
+    }
+}
+
+// Worker thread: run jobs until the queue is empty and the watch stops
+static void *watch_worker(void *arg)
+{
+    WatchInfo *watchInfo = arg;
+    char *io_buffer = malloc(2 * IO_BUFFER_SIZE);
+
+    for (;;)
+    {
+        pthread_mutex_lock(&watchInfo->lock);
+        while (watchInfo->depth == 0 && !watchInfo->stopping)
+            pthread_cond_wait(&watchInfo->not_empty, &watchInfo->lock);
+        if (watchInfo->depth == 0)
+        {
+            pthread_mutex_unlock(&watchInfo->lock);
+            break;
+        }
+        WatchJob *wj = watchInfo->queue[watchInfo->head];
+        watchInfo->head = (watchInfo->head + 1) % WATCH_QUEUE_SIZE;
+        watchInfo->depth--;
+        watchInfo->running[watchInfo->nrunning++] = wj;
+        pthread_cond_signal(&watchInfo->not_full);
+        pthread_mutex_unlock(&watchInfo->lock);
+
+        Status status = run_batch_job(&wj->job, io_buffer);
+
+        // Queue drained: outputs waiting for a group sync go out now
+        pthread_mutex_lock(&watchInfo->lock);
+        int idle = watchInfo->depth == 0;
+        pthread_mutex_unlock(&watchInfo->lock);
+        if (idle && flush_output_group() == failure)
+            status = failure;
+        double latency = get_seconds() - wj->arrived;
+
+        pthread_mutex_lock(&watchInfo->lock);
+        for (int i = 0; i < watchInfo->nrunning; i++)
+        {
+            if (watchInfo->running[i] == wj)
+            {
+                watchInfo->running[i] = watchInfo->running[--watchInfo->nrunning];
+                break;
+            }
+        }
+        if (status == success)
+            watchInfo->ok++;
+        else
+            watchInfo->failed++;
+        watchInfo->latency_sum += latency;
+        if (latency > watchInfo->latency_max)
+            watchInfo->latency_max = latency;
+        if (status == success)
+            fprintf(watchInfo->fptr_report, GREEN"[ok]    "RESET" %s -> %s (latency %.3f s, queue %d)\n",
+                    wj->job.argv[2], wj->job.result_fname, latency, watchInfo->depth);
+        else
+            fprintf(watchInfo->fptr_report, RED"[FAILED]"RESET" %s (latency %.3f s, queue %d)\n",
+                    wj->job.argv[2], latency, watchInfo->depth);
+        pthread_mutex_unlock(&watchInfo->lock);
+
+        free_watch_job(wj);
+    }
+
+    free(io_buffer);
+    return NULL;
+}
+
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t counters_requested = 0;
+
+static void handle_watch_signal(int sig)
+{
+    if (sig == SIGUSR1)
+        counters_requested = 1;
+    else
+        stop_requested = 1;
+}
+
+/* Process files as they land until SIGINT/SIGTERM
+ * Description: inotify reports a file once its writer closed it
+ * (IN_CLOSE_WRITE) or once it was renamed into the spool (IN_MOVED_TO),
+ * so partially written files are never picked up. SIGUSR1 prints the
+ * counters.
+ */
+Status do_watch(WatchInfo *watchInfo)
+{
+    // 1. Watch the spool directories
+    watchInfo->fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (watchInfo->fd < 0)
+    {
+        perror(RED"ERROR: Unable to start inotify"RESET);
+        return failure;
+    }
+    uint32_t events = IN_CLOSE_WRITE | IN_MOVED_TO;
+    watchInfo->wd_input = inotify_add_watch(watchInfo->fd, watchInfo->input_dir, events);
+    watchInfo->wd_secret = -1;
+    if (watchInfo->op == encode)
+        watchInfo->wd_secret = inotify_add_watch(watchInfo->fd, watchInfo->secret_dir, events);
+    if (watchInfo->wd_input < 0 || (watchInfo->op == encode && watchInfo->wd_secret < 0))
+    {
+        perror(RED"ERROR: Unable to watch spool directory"RESET);
+        close(watchInfo->fd);
+        return failure;
+    }
+
+    /* 2. Signals go to this thread only, and only inside ppoll() below:
+     * they stay blocked everywhere else, so one landing between the
+     * stop_requested test and the wait is held until ppoll() unblocks it
+     * instead of being lost.
+     */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_watch_signal; // No SA_RESTART
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    sigset_t signals, old_signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, &old_signals);
+
+    // 3. Start the workers
+    pthread_mutex_init(&watchInfo->lock, NULL);
+    pthread_cond_init(&watchInfo->not_empty, NULL);
+    pthread_cond_init(&watchInfo->not_full, NULL);
+    watchInfo->nworkers = get_thread_count();
+    pthread_t tids[MAX_THREADS];
+    int started = 0;
+    for (int w = 0; w < watchInfo->nworkers; w++)
+        if (pthread_create(&tids[started], NULL, watch_worker, watchInfo) == 0)
+            started++;
+
+    Status status = success;
+    if (started == 0)
+    {
+        fprintf(stderr, RED"ERROR: Unable to start workers\n"RESET);
+        status = failure;
+    }
+    else
+    {
+        // 4. Catch up with files that landed while we were not running
+        scan_spool(watchInfo);
+        fprintf(watchInfo->fptr_report, YELLOW"INFO: Watching %s%s%s with %d workers (Ctrl-C to stop, SIGUSR1 for counters)\n"RESET,
+                watchInfo->input_dir, watchInfo->secret_dir ? " and " : "",
+                watchInfo->secret_dir ? watchInfo->secret_dir : "", started);
+    }
+
+    // 5. Event loop
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (status == success && !stop_requested)
+    {
+        if (counters_requested)
+        {
+            counters_requested = 0;
+            print_watch_counters(watchInfo);
+        }
+
+        struct pollfd pfd = { watchInfo->fd, POLLIN, 0 };
+        if (ppoll(&pfd, 1, NULL, &old_signals) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror(RED"ERROR: Unable to wait for inotify events"RESET);
+            status = failure;
+            break;
+        }
+
+        ssize_t n = read(watchInfo->fd, buffer, sizeof(buffer));
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            perror(RED"ERROR: Unable to read inotify events"RESET);
+            status = failure;
+            break;
+        }
+
+        double now = get_seconds();
+        const struct inotify_event *event;
+        for (char *p = buffer; p < buffer + n; p += sizeof(struct inotify_event) + event->len)
+        {
+            event = (const struct inotify_event *)p;
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                fprintf(stderr, YELLOW"WARNING: inotify queue overflowed, rescanning the spool\n"RESET);
+                scan_spool(watchInfo);
+                continue;
+            }
+            if (event->len == 0)
+                continue;
+            handle_arrival(watchInfo, event->wd == watchInfo->wd_secret, event->name, now, 0);
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    // 6. Finish the queued jobs and stop the workers
+    pthread_mutex_lock(&watchInfo->lock);
+    watchInfo->stopping = 1;
+    pthread_cond_broadcast(&watchInfo->not_empty);
+    pthread_mutex_unlock(&watchInfo->lock);
+    for (int w = 0; w < started; w++)
+        pthread_join(tids[w], NULL);
+    if (flush_output_group() == failure)
+        status = failure;
+
+    print_watch_counters(watchInfo);
+
+    close(watchInfo->fd);
+    free_pending(&watchInfo->covers);
+    free_pending(&watchInfo->secrets);
+    pthread_cond_destroy(&watchInfo->not_full);
+    pthread_cond_destroy(&watchInfo->not_empty);
+    pthread_mutex_destroy(&watchInfo->lock);
+    return status;
+}
+
+#else
+
+/* inotify is Linux only */
+Status do_watch(WatchInfo *watchInfo)
+{
+    (void)watchInfo;
+    fprintf(stderr, RED"ERROR: Watch mode needs Linux (inotify)\n"RESET);
+    return failure;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "types.h" // Contains user defined types
+#include "batch.h"
+#include "parallel.h" // Contains MAX_THREADS
+
+/* Jobs waiting for a worker; the event loop blocks when the queue is full */
+#define WATCH_QUEUE_SIZE 256
+
+/*
+ * One file (decoding) or cover/secret pair (encoding) that landed in
+ * the spool
+ */
+typedef struct _WatchJob
+{
+    BatchJob job;   // Arguments for run_batch_job()
+    double arrived; // When the input was seen
+} WatchJob;
+
+/* Names seen in a spool directory that are still waiting for their partner */
+typedef struct _PendingList
+{
+    char **names;
+    int count;
+    int capacity;
+} PendingList;
+
+/*
+ * Structure to store information required for
+ * watching spool directories
+ */
+typedef struct _WatchInfo
+{
+    OperationType op;  // encode or decode
+    char *input_dir;   // Covers (encoding) or stego images (decoding)
+    char *secret_dir;  // Secrets (encoding only)
+    char *out_dir;     // Where finished outputs are moved
+    int fd;            // inotify descriptor
+    int wd_input;
+    int wd_secret;
+    PendingList covers;  // Cover names without a secret yet
+    PendingList secrets; // Secret names without a cover yet
+
+    /* Bounded job queue */
+    WatchJob *queue[WATCH_QUEUE_SIZE];
+    int head;
+    int depth;
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    int nworkers;
+    WatchJob *running[MAX_THREADS]; // Jobs the workers are on
+    int nrunning;
+    FILE *fptr_report; // Where the report goes (the real stdout)
+
+    /* Counters */
+    unsigned long queued;
+    unsigned long ok;
+    unsigned long failed;
+    int max_depth;
+    double latency_sum;
+    double latency_max;
+} WatchInfo;
+
+/* Watch function prototypes */
+
+/* Read and validate watch args from argv */
+Status read_and_validate_watch_args(int argc, char *argv[], WatchInfo *watchInfo);
+
+/* Process files as they land until SIGINT/SIGTERM */
+Status do_watch(WatchInfo *watchInfo);
+
+/* Print the queue and latency counters */
+void print_watch_counters(WatchInfo *watchInfo);
+
+#endif